@@ -0,0 +1,59 @@
+from struct import pack
+
+DELTA_OP_COPY = 0x01    # offset (4B), length (2B) - copy from base image
+DELTA_OP_INSERT = 0x02  # length (2B), data - literal bytes
+
+_block_size = 16
+_max_op_len = 0xFFFF
+
+def _emit_insert(patch: bytearray, data: bytes):
+    for pos in range(0, len(data), _max_op_len):
+        chunk = data[pos:pos + _max_op_len]
+        patch += pack(">BH", DELTA_OP_INSERT, len(chunk)) + chunk
+
+def create_patch(base: bytes, new: bytes) -> bytes:
+    index = {}
+    for offset in range(0, len(base) - _block_size + 1, _block_size):
+        index.setdefault(base[offset:offset + _block_size], offset)
+
+    patch = bytearray()
+    literal_start = 0
+    pos = 0
+
+    while pos + _block_size <= len(new):
+        base_offset = index.get(new[pos:pos + _block_size])
+        if base_offset is None:
+            pos += 1
+            continue
+
+        # extend match as far as possible
+        match_len = _block_size
+        while (pos + match_len < len(new) and base_offset + match_len < len(base)
+               and match_len < _max_op_len and new[pos + match_len] == base[base_offset + match_len]):
+            match_len += 1
+
+        _emit_insert(patch, new[literal_start:pos])
+        patch += pack(">BLH", DELTA_OP_COPY, base_offset, match_len)
+        pos += match_len
+        literal_start = pos
+
+    _emit_insert(patch, new[literal_start:])
+    return bytes(patch)
+
+def apply_patch(base: bytes, patch: bytes) -> bytes:
+    out = bytearray()
+    pos = 0
+    while pos < len(patch):
+        op = patch[pos]
+        if op == DELTA_OP_COPY:
+            offset = int.from_bytes(patch[pos + 1:pos + 5], "big")
+            length = int.from_bytes(patch[pos + 5:pos + 7], "big")
+            out += base[offset:offset + length]
+            pos += 7
+        elif op == DELTA_OP_INSERT:
+            length = int.from_bytes(patch[pos + 1:pos + 3], "big")
+            out += patch[pos + 3:pos + 3 + length]
+            pos += 3 + length
+        else:
+            raise ValueError("Unknown delta op")
+    return bytes(out)
@@ -0,0 +1,49 @@
+# Reed-Solomon encoder matching Core/FVC/fvc_fec.h
+_block_len = 255
+_parity_len = 16
+_block_data_len = _block_len - _parity_len
+_primitive_poly = 0x11D
+
+_gf_exp = [0] * 512
+_gf_log = [0] * 256
+
+_value = 1
+for _i in range(255):
+    _gf_exp[_i] = _value
+    _gf_exp[_i + 255] = _value
+    _gf_log[_value] = _i
+    _value <<= 1
+    if _value & 0x100:
+        _value ^= _primitive_poly
+
+def _gf_mul(a: int, b: int) -> int:
+    if a == 0 or b == 0:
+        return 0
+    return _gf_exp[_gf_log[a] + _gf_log[b]]
+
+def _generator_poly() -> list:
+    # product of (x - a^i), highest power first
+    generator = [1]
+    for i in range(_parity_len):
+        root = _gf_exp[i]
+        result = [0] * (len(generator) + 1)
+        for j, coef in enumerate(generator):
+            result[j] ^= coef
+            result[j + 1] ^= _gf_mul(coef, root)
+        generator = result
+    return generator
+
+_generator = _generator_poly()
+
+def _encode_block(data: bytes) -> bytes:
+    remainder = [0] * _parity_len
+    for byte in data:
+        factor = byte ^ remainder[0]
+        remainder = remainder[1:] + [0]
+        if factor:
+            for j in range(_parity_len):
+                remainder[j] ^= _gf_mul(_generator[j + 1], factor)
+    return bytes(data) + bytes(remainder)
+
+def encode(data: bytes) -> bytes:
+    return b''.join(_encode_block(data[i:i + _block_data_len]) for i in range(0, len(data), _block_data_len))
@@ -1,4 +1,13 @@
 import hmac
 
 def hmac_calc(data: bytes, key: bytes) -> bytes:
-    return hmac.new(key,data,'sha256').digest()
\ No newline at end of file
+    return hmac.new(key,data,'sha256').digest()
+
+def crc32_calc(data: bytes, crc: int = 0xFFFFFFFF) -> int:
+    # CRC-32/MPEG-2, same as fvc_calc_crc on the board
+    for byte in data:
+        crc ^= byte << 24
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x04C11DB7) if (crc & 0x80000000) else (crc << 1)
+            crc &= 0xFFFFFFFF
+    return crc
@@ -0,0 +1,58 @@
+# Decoder of TYPE_LOG_DATA records, matching Core/FVC/fvc_log.h
+import re
+from struct import unpack, unpack_from
+
+_section_name = b'.fvc_log_fmt'
+_record_header_len = 7
+
+# printf conversion, length modifiers are stripped since python formatting rejects hh, ll, z and t
+_conversion = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z|t)?([diouxXc%])')
+
+def load_strings(elf_path: str) -> bytes:
+    """Returns content of format string section from firmware ELF, None if it is missing"""
+    with open(elf_path, "rb") as elf:
+        image = elf.read()
+
+    if image[:4] != b'\x7fELF' or image[4] != 1:
+        return None
+
+    # 32-bit little endian ELF, section headers
+    (shoff,) = unpack_from("<L", image, 0x20)
+    (shentsize, shnum, shstrndx) = unpack_from("<HHH", image, 0x2E)
+    sections = [unpack_from("<LLLLLL", image, shoff + i * shentsize) for i in range(shnum)]
+    names_offset = sections[shstrndx][4]
+
+    for (name, sh_type, flags, addr, offset, size) in sections:
+        end = image.index(b'\0', names_offset + name)
+        if image[names_offset + name:end] == _section_name:
+            return image[offset:offset + size]
+    return None
+
+def _format(fmt: str, args: tuple) -> str:
+    values = []
+    for match in _conversion.finditer(fmt):
+        if match.group(2) == '%':
+            continue
+        value = args[len(values)] if len(values) < len(args) else 0
+        if match.group(2) in 'di' and value & 0x80000000:
+            value -= 1 << 32
+        values.append(value)
+    return _conversion.sub(r'%\1\2', fmt) % tuple(values)
+
+def decode(payload: bytes, strings: bytes) -> tuple:
+    """Returns (dropped records, [(tick ms, text)])"""
+    (dropped,) = unpack(">L", payload[:4])
+    records = []
+    pos = 4
+    while pos + _record_header_len <= len(payload):
+        (tick, fmt_id, nargs) = unpack_from(">LHB", payload, pos)
+        pos += _record_header_len
+        args = unpack_from(">" + "L" * nargs, payload, pos)
+        pos += 4 * nargs
+
+        if strings is not None and fmt_id < len(strings):
+            fmt = strings[fmt_id:strings.index(b'\0', fmt_id)].decode(errors="replace")
+            records.append((tick, _format(fmt, args)))
+        else:
+            records.append((tick, "<format %d> %s" % (fmt_id, " ".join(hex(arg) for arg in args))))
+    return (dropped, records)
@@ -0,0 +1,75 @@
+from struct import pack
+
+# LZSS stream matching Core/FVC/fvc_lz.h
+_window_size = 4096
+_min_match = 3
+_max_match = _min_match + 15
+_max_chain = 64
+
+def compress(data: bytes) -> bytes:
+    out = bytearray()
+    chains = {}
+    pos = 0
+    
+    flags_pos = 0
+    flags_bit = 8
+    
+    while pos < len(data):
+        if flags_bit == 8: # start new group of 8 items
+            flags_pos = len(out)
+            out.append(0)
+            flags_bit = 0
+        
+        best_len = 0
+        best_dist = 0
+        key = data[pos:pos + _min_match]
+        candidates = chains.get(key, [])
+        for candidate in reversed(candidates[-_max_chain:]):
+            dist = pos - candidate
+            if dist > _window_size:
+                break
+            length = 0
+            while (length < _max_match and pos + length < len(data)
+                   and data[candidate + length] == data[pos + length]):
+                length += 1
+            if length > best_len:
+                best_len = length
+                best_dist = dist
+                if length == _max_match:
+                    break
+        
+        if best_len >= _min_match:
+            out += pack(">H", ((best_dist - 1) << 4) | (best_len - _min_match))
+            step = best_len
+        else:
+            out[flags_pos] |= 1 << flags_bit
+            out.append(data[pos])
+            step = 1
+        flags_bit += 1
+        
+        for i in range(pos, pos + step):
+            if i + _min_match <= len(data):
+                chains.setdefault(data[i:i + _min_match], []).append(i)
+        pos += step
+    
+    return bytes(out)
+
+def decompress(data: bytes) -> bytes:
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        flags = data[pos]
+        pos += 1
+        for bit in range(8):
+            if pos >= len(data):
+                break
+            if flags & (1 << bit):
+                out.append(data[pos])
+                pos += 1
+            else:
+                token = (data[pos] << 8) | data[pos + 1]
+                pos += 2
+                dist = (token >> 4) + 1
+                for _ in range((token & 0x0F) + _min_match):
+                    out.append(out[-dist])
+    return bytes(out)
@@ -1,4 +1,4 @@
-from enum import IntEnum
+from enum import IntEnum, IntFlag
 from struct import pack, unpack
 import numpy as np
 
@@ -16,6 +16,33 @@ class data_types(IntEnum):
     TYPE_PROGRAM_UPDATE_FINISHED = 8
     TYPE_EEPROM_DATA_READ = 9
     TYPE_EEPROM_DATA_WRITE = 10
+    TYPE_PROGRAM_MULTICAST_DATA = 11
+    TYPE_PROGRAM_MULTICAST_STATUS = 12
+    TYPE_PROGRAM_MULTICAST_COMMIT = 13
+    TYPE_BAUD_SWITCH_REQUEST = 14
+    TYPE_BAUD_SWITCH_PROBE = 15
+    TYPE_LINK_STATUS = 16
+    TYPE_SCRUB_REQUEST = 17
+    TYPE_SCRUB_STATUS = 18
+    TYPE_SUPERVISION_STATS_REQUEST = 19
+    TYPE_SUPERVISION_STATS = 20
+    TYPE_LOG_DATA = 21
+
+class update_flags(IntFlag):
+    UPDATE_FLAG_NONE = 0
+    UPDATE_FLAG_DELTA = 1 << 0
+    UPDATE_FLAG_COMPRESSED = 1 << 1
+    UPDATE_FLAG_MULTICAST = 1 << 2
+    UPDATE_FLAG_FEC = 1 << 3
+    UPDATE_FLAG_RESUME = 1 << 4
+
+# interface capabilities of TYPE_ID_RESP
+class capabilities(IntFlag):
+    CAPABILITY_ADDRESS_MARK = 1 << 0
+
+# destination IDs reserved for multicast groups
+group_id_min = 0xF0
+group_id_max = 0xFE
     
 starting_crc_value = 0xff
 
@@ -67,12 +94,67 @@ def serialize_packet(d_type: data_types._member_names_, dest_addr: int, data: by
             packet += pack(">"+str(len(data))+"s", data)
         case data_types.TYPE_PROGRAM_UPDATE_REQUEST:
             packet += pack(">"+str(len(data))+"s", data)
+        case data_types.TYPE_PROGRAM_MULTICAST_DATA:
+            packet += pack(">"+str(len(data))+"s", data)
+        case data_types.TYPE_BAUD_SWITCH_REQUEST:
+            packet += pack(">"+str(len(data))+"s", data)
+        case data_types.TYPE_SCRUB_REQUEST:
+            packet += pack(">"+str(len(data))+"s", data)
+        case data_types.TYPE_SUPERVISION_STATS_REQUEST:
+            packet += pack(">"+str(len(data))+"s", data)
         case other:
             pass
     
     packet = packet + pack(">B", crc_calc(packet))
     return packet
 
+def parse_id_resp(payload: bytes) -> dict:
+    (protocol_version, firmware_version, max_data_size, window_size, supported_flags, max_baudrate, default_baudrate, caps) = unpack(">BLHBBLLB", payload[:18])
+    return {"protocol_version": protocol_version,
+            "firmware_version": firmware_version,
+            "max_data_size": max_data_size,
+            "window_size": window_size,
+            "update_flags": update_flags(supported_flags),
+            "max_baudrate": max_baudrate,
+            "default_baudrate": default_baudrate,
+            "capabilities": capabilities(caps)}
+
+def parse_link_status(payload: bytes) -> dict:
+    (frames, crc_errors, timeouts, nacks, frame_len, fec_corrected, fec_failed, fec_cycles) = unpack(">LLLLHLLL", payload[:30])
+    return {"frames": frames, "crc_errors": crc_errors, "timeouts": timeouts, "nacks": nacks, "frame_len": frame_len,
+            "fec_corrected": fec_corrected, "fec_failed": fec_failed, "fec_cycles_per_codeword": fec_cycles}
+
+# TYPE_SCRUB_REQUEST flags
+SCRUB_FLAG_TARGET = 1 << 0
+
+scrub_results = ("none", "ok", "mismatch", "read error")
+
+def parse_scrub_status(payload: bytes) -> dict:
+    status = {}
+    for region, offset in (("backup", 0), ("target", 9)):
+        (result, boot_count, uptime) = unpack(">BLL", payload[offset:offset + 9])
+        status[region] = {"result": scrub_results[result] if result < len(scrub_results) else result,
+                          "boot_count": boot_count, "uptime_s": uptime}
+    return status
+
+# TYPE_SUPERVISION_STATS_REQUEST flags
+SUPERVISION_STATS_FLAG_CLEAR = 1 << 0
+
+supervision_histogram_buckets = 32
+
+def parse_supervision_stats(payload: bytes) -> dict:
+    (state, var_nb, refreshes, early, crc_errors, resets, interval_min, interval_max, interval_mean, interval_last) = unpack(">BBLLLLLLLL", payload[:34])
+    histogram_end = 34 + 4 * supervision_histogram_buckets
+    histogram = unpack(">" + "L" * supervision_histogram_buckets, payload[34:histogram_end])
+    (first_var, var_cnt) = unpack(">BB", payload[histogram_end:histogram_end + 2])
+    out_of_range = unpack(">" + "L" * var_cnt, payload[histogram_end + 2:histogram_end + 2 + 4 * var_cnt])
+    # bucket n holds intervals from 2^n us
+    return {"state": state, "var_nb": var_nb, "refreshes": refreshes, "early_refreshes": early,
+            "crc_errors": crc_errors, "resets": resets, "interval_min_us": interval_min,
+            "interval_max_us": interval_max, "interval_mean_us": interval_mean, "interval_last_us": interval_last,
+            "interval_histogram": {1 << n: count for n, count in enumerate(histogram) if count},
+            "first_var": first_var, "out_of_range": list(out_of_range)}
+
 def deserialzie_packet(package: bytes):
     if crc_calc(package) != 0:
         return None
@@ -5,29 +5,56 @@ import time
 import signal
 
 import fvc_protocol
-from struct import pack
+from struct import pack, unpack
 
-from fvc_hash import hmac_calc
+from fvc_hash import hmac_calc, crc32_calc
+from fvc_delta import create_patch
+import fvc_lz
+import fvc_fec
+import fvc_log
 from usart_process import SerialProcess
 
 _port = "COM6"
-_baudrate = 921600
+_baudrate = 921600              # default rate, boards start and fall back to it
+_update_baudrate = 4000000      # negotiated for updates, 0 disables switching
 
 _default_timeout_value_ns = 20*pow(10,9) # 20 s
 _timeout_for_end_of_update = 120*pow(10,9) # 20 s
+_baud_switch_timeout_ns = 4*pow(10,9) # board waits 3 s for probe
 _max_retransfers = 5
+_fec_board_ids = []             # boards on noisy bus segments, program frames carry Reed-Solomon parity
+_prefer_resumable = False       # send plain images, only those can be resumed after link loss
+_log_elf_path = "../STM32/FVC_V1_0/Debug/FVC_V1_0.elf"     # firmware build, holds format strings of TYPE_LOG_DATA records
 
 _hmac_key = b'secret_key'
 
-max_data_size = 2*1024
+_multicast_group_id = 0xF0
+_multicast_erase_time_s = 5         # boards erase backup slot after joining
+_multicast_char_bits = 10           # start, 8 data, stop, address-mark boards add 9th bit
+_w25q_page_program_max_s = 0.003    # W25Q tPP max, boards program a packet before listening again
+_multicast_max_rounds = 10
+_multicast_status_timeout_ns = 1*pow(10,9)
 
-def calc_packet_quantity(data_size):
+max_data_size = 16*1024             # host limit, boards advertise their own in TYPE_ID_RESP
+legacy_data_size = 2*1024           # boards without TYPE_ID_RESP support
+
+# assumed for boards that do not answer TYPE_ID_REQ
+legacy_board_info = {"max_data_size": legacy_data_size,
+                     "update_flags": fvc_protocol.update_flags.UPDATE_FLAG_NONE,
+                     "max_baudrate": _baudrate}
+
+def calc_packet_quantity(data_size, packet_size):
     packet_quantity = 0
     while (data_size > 0):
         packet_quantity += 1
-        data_size = data_size - max_data_size
+        data_size = data_size - packet_size
     return packet_quantity
 
+def choosePacketSize(boardsInfo: list) -> int:
+    # largest frame accepted by every board, whole 256 B blocks keep target writes aligned
+    size = min([max_data_size] + [info["max_data_size"] for info in boardsInfo])
+    return max(256, size - (size % 256))
+
 def parseData(rxQueue: Queue, endEvent: Event, timeout = _default_timeout_value_ns):
     timeout = time.time_ns() + timeout
     
@@ -36,83 +63,327 @@ def parseData(rxQueue: Queue, endEvent: Event, timeout = _default_timeout_value_
             return fvc_protocol.deserialzie_packet(rxQueue.get(timeout=0.1))
     return None
 
-def boardUpdateProcess(boardID: int, programPath: str, txQueue: Queue, rxQueueu: Queue, endEvent: Event):
+def nextPacketSize(response: tuple, packetSize: int, maxPacketSize: int, frameOk: bool) -> int:
+    # board recommends frame length in ACK/NACK payload based on errors it observed
+    if len(response) == 7 and len(response[5]) >= 2:
+        size = int.from_bytes(response[5][:2], "big")
+    elif frameOk:
+        size = packetSize
+    else:
+        size = packetSize // 2
+    return min(maxPacketSize, max(256, size - (size % 256)))
+
+def queryLinkStatus(boardID: int, txQueue: Queue, rxQueue: Queue, endEvent: Event):
+    txQueue.put(fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_LINK_STATUS, int(boardID), b''))
+    data = parseData(rxQueue, endEvent, timeout=_baud_switch_timeout_ns)
+    if data != None and data[4] == fvc_protocol.data_types.TYPE_LINK_STATUS:
+        return fvc_protocol.parse_link_status(data[5])
+    return None
+
+def queryScrubStatus(boardID: int, verifyTarget: bool, txQueue: Queue, rxQueue: Queue, endEvent: Event):
+    # target verification stops application until board finishes it
+    flags = fvc_protocol.SCRUB_FLAG_TARGET if verifyTarget else 0
+    txQueue.put(fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_SCRUB_REQUEST, int(boardID), pack(">B", flags)))
+    data = parseData(rxQueue, endEvent, timeout=_baud_switch_timeout_ns)
+    if data != None and data[4] == fvc_protocol.data_types.TYPE_SCRUB_STATUS:
+        return fvc_protocol.parse_scrub_status(data[5])
+    return None
+
+def querySupervisionStats(boardID: int, clear: bool, txQueue: Queue, rxQueue: Queue, endEvent: Event):
+    # out-of-range counters come in pages, clearing is a separate request sent after all pages are read
+    stats = None
+    firstVar = 0
+    while True:
+        txQueue.put(fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_SUPERVISION_STATS_REQUEST, int(boardID), pack(">BB", firstVar, 0)))
+        data = parseData(rxQueue, endEvent, timeout=_baud_switch_timeout_ns)
+        if data == None or data[4] != fvc_protocol.data_types.TYPE_SUPERVISION_STATS:
+            return stats
+        page = fvc_protocol.parse_supervision_stats(data[5])
+        if stats == None:
+            stats = page
+        else:
+            stats["out_of_range"] += page["out_of_range"]
+        firstVar += len(page["out_of_range"])
+        if len(page["out_of_range"]) == 0 or firstVar >= page["var_nb"]:
+            break
+
+    if clear:
+        txQueue.put(fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_SUPERVISION_STATS_REQUEST, int(boardID), pack(">BB", 0xFF, fvc_protocol.SUPERVISION_STATS_FLAG_CLEAR)))
+        parseData(rxQueue, endEvent, timeout=_baud_switch_timeout_ns)
+    stats.pop("first_var")
+    return stats
+
+def requestBoardInfo(boardID: int, txQueue: Queue, rxQueue: Queue, endEvent: Event) -> dict:
+    txQueue.put(fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_ID_REQ, int(boardID), b''))
+    data = parseData(rxQueue, endEvent, timeout=_baud_switch_timeout_ns)
+    if data != None and data[4] == fvc_protocol.data_types.TYPE_ID_RESP:
+        return fvc_protocol.parse_id_resp(data[5])
+    return None
+
+def queryBoardInfo(boardID: int, txQueue: Queue, rxQueue: Queue, endEvent: Event) -> dict:
+    # boards in address-mark mode ignore plain frames, framing is kept only if board advertises it
+    info = requestBoardInfo(boardID, txQueue, rxQueue, endEvent)
+    if info == None:
+        txQueue.put(("address_mark", int(boardID), True))
+        info = requestBoardInfo(boardID, txQueue, rxQueue, endEvent)
+        if info == None or not (info["capabilities"] & fvc_protocol.capabilities.CAPABILITY_ADDRESS_MARK):
+            txQueue.put(("address_mark", int(boardID), False))
+    
+    if info != None:
+        print("Board with ID:", boardID, info)
+        print("Integrity of board with ID:", boardID, queryScrubStatus(boardID, False, txQueue, rxQueue, endEvent))
+        print("Supervision of board with ID:", boardID, querySupervisionStats(boardID, False, txQueue, rxQueue, endEvent))
+        return info
+    
+    print("Board with ID:", boardID, "did not answer ID request, using legacy parameters")
+    return legacy_board_info
+
+def compressPayload(update: tuple):
+    (payload, flags, base_crc) = update
+    compressed = fvc_lz.compress(payload)
+    if len(compressed) >= len(payload):
+        return update
+    
+    print("Compressed payload:", len(compressed), "B instead of", len(payload), "B")
+    return (compressed, flags | fvc_protocol.update_flags.UPDATE_FLAG_COMPRESSED, base_crc)
+
+def prepareUpdatePayload(programPath: str, basePath: str, supportedFlags: int):
+    with open(programPath, "rb") as file:
+        program_data = file.read()
+    
+    hmac_sha = hmac_calc(program_data, _hmac_key)
+    if _prefer_resumable and (supportedFlags & fvc_protocol.update_flags.UPDATE_FLAG_RESUME):
+        supportedFlags &= ~(fvc_protocol.update_flags.UPDATE_FLAG_COMPRESSED | fvc_protocol.update_flags.UPDATE_FLAG_DELTA)
+    full_update = (program_data, fvc_protocol.update_flags.UPDATE_FLAG_NONE, 0)
+    if supportedFlags & fvc_protocol.update_flags.UPDATE_FLAG_COMPRESSED:
+        full_update = compressPayload(full_update)
+    
+    if basePath == None or not (supportedFlags & fvc_protocol.update_flags.UPDATE_FLAG_DELTA):
+        return (hmac_sha, full_update, None)
+    
+    with open(basePath, "rb") as file:
+        base_data = file.read()
+    
+    patch = create_patch(base_data, program_data)
+    if len(patch) >= len(program_data):
+        return (hmac_sha, full_update, None)
+    
+    print("Delta update:", len(patch), "B instead of", len(program_data), "B")
+    delta_update = (patch, fvc_protocol.update_flags.UPDATE_FLAG_DELTA, crc32_calc(base_data))
+    if supportedFlags & fvc_protocol.update_flags.UPDATE_FLAG_COMPRESSED:
+        delta_update = compressPayload(delta_update)
+    return (hmac_sha, delta_update, full_update)
+
+def transferFlags(boardID: int, boardInfo: dict, flags: int) -> int:
+    supported = boardInfo["update_flags"]
+    if int(boardID) in _fec_board_ids and (supported & fvc_protocol.update_flags.UPDATE_FLAG_FEC):
+        flags |= fvc_protocol.update_flags.UPDATE_FLAG_FEC
+    # board keeps checkpoints for plain images only
+    if (supported & fvc_protocol.update_flags.UPDATE_FLAG_RESUME) and not (flags & (fvc_protocol.update_flags.UPDATE_FLAG_COMPRESSED | fvc_protocol.update_flags.UPDATE_FLAG_DELTA)):
+        flags |= fvc_protocol.update_flags.UPDATE_FLAG_RESUME
+    return flags
+
+def boardUpdateProcess(boardID: int, boardInfo: dict, programPath: str, basePath: str, txQueue: Queue, rxQueueu: Queue, endEvent: Event):
     timer_start = time.time_ns()
     state = 0
     update_status = False
     retransfers_counter = 0
     
     program_packet = None
-    hmac_sha = None
-    packet_count = None
+    max_packet_size = choosePacketSize([boardInfo])
+    packet_size = max_packet_size
+    adaptive = "protocol_version" in boardInfo # legacy boards need fixed frame length
+    link_stats = {"frames": 0, "nacks": 0, "timeouts": 0}
+    (hmac_sha, update, fallback_update) = prepareUpdatePayload(programPath, basePath, boardInfo["update_flags"])
+    (payload, flags, base_crc) = update
+    flags = transferFlags(boardID, boardInfo, flags)
+    payload_offset = 0
+    packet_count = calc_packet_quantity(len(payload), packet_size)
     
-    with open(programPath, "rb") as file:
-        data_size = os.path.getsize(programPath)
-        program_data = file.read(data_size)
-        packet_count = calc_packet_quantity(data_size)
-        hmac_sha = hmac_calc(program_data, _hmac_key)
-        
-    with open(programPath, "rb") as file:
-        while not endEvent.is_set():
-            match state:
-                case 0: # Update request
-                    data = fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_PROGRAM_UPDATE_REQUEST, int(boardID), pack(">LL32s", 1, packet_count, hmac_sha))
-                    txQueue.put(data)
+    while not endEvent.is_set():
+        match state:
+            case 0: # Update request
+                data = fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_PROGRAM_UPDATE_REQUEST, int(boardID), pack(">LL32sBLBHL", 1, packet_count, hmac_sha, flags, base_crc, 0, packet_size, len(payload) if adaptive else 0))
+                txQueue.put(data)
+                data = parseData(rxQueueu, endEvent)
+                if data != None and data[4] == fvc_protocol.data_types.TYPE_ACK:
+                    if (flags & fvc_protocol.update_flags.UPDATE_FLAG_RESUME) and len(data) == 7:
+                        (payload_offset, _) = unpack(">LL", data[5][:8])
+                        if payload_offset:
+                            print("Resuming update of board with ID:", boardID, "at", payload_offset, "of", len(payload), "B")
+                    state = 1
+                elif data != None and fallback_update != None: # board has different base image
+                    print("Delta update rejected by board with ID:", boardID, ". Sending full program.")
+                    (payload, flags, base_crc) = fallback_update
+                    flags = transferFlags(boardID, boardInfo, flags)
+                    packet_count = calc_packet_quantity(len(payload), packet_size)
+                    fallback_update = None
+                elif data != None and data[4] == fvc_protocol.data_types.TYPE_NACK:
+                    endEvent.set()
+                else:
+                    endEvent.set()
+                    
+            case 1: # Prepare packet
+                program_data = payload[payload_offset:payload_offset + packet_size]
+                if len(program_data) > 0:
+                    program_packet = fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_PROGRAM_DATA, int(boardID), fvc_fec.encode(program_data) if flags & fvc_protocol.update_flags.UPDATE_FLAG_FEC else program_data)
+                    state = 2
+                else: # finish update if there is no more data to be send
+                    print("All packets have been transmitted for board with ID:", boardID," (Took:", (time.time_ns() - timer_start)/1000000 ,"ms)")
+                    update_status = True
+                    endEvent.set()
+
+            case 2: # send packet
+                if retransfers_counter < _max_retransfers:
+                    txQueue.put(program_packet)
+                    
                     data = parseData(rxQueueu, endEvent)
                     if data != None and data[4] == fvc_protocol.data_types.TYPE_ACK:
+                        payload_offset += len(program_data)
+                        retransfers_counter = 0
+                        link_stats["frames"] += 1
+                        if adaptive:
+                            packet_size = nextPacketSize(data, packet_size, max_packet_size, True)
                         state = 1
                     elif data != None and data[4] == fvc_protocol.data_types.TYPE_NACK:
-                        endEvent.set()
-                    else:
-                        endEvent.set()
-                        
-                case 1: # Prepare packet
-                    retransfers_counter = 0
-                    program_data = file.read(max_data_size)
-                    if len(program_data) > 0:
-                        program_packet = fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_PROGRAM_DATA, int(boardID), program_data)
-                        state = 2
-                    else: # finish update if there is no more data to be send
-                        print("All packets have been transmitted for board with ID:", boardID," (Took:", (time.time_ns() - timer_start)/1000000 ,"ms)")
-                        update_status = True
-                        endEvent.set()
-
-                case 2: # send packet
-                    if retransfers_counter < _max_retransfers:
-                        txQueue.put(program_packet)
-                        
-                        data = parseData(rxQueueu, endEvent)
-                        if data != None and data[4] == fvc_protocol.data_types.TYPE_ACK:
+                        retransfers_counter += 1
+                        link_stats["nacks"] += 1
+                        if adaptive: # frame is sliced again with new length
+                            packet_size = nextPacketSize(data, packet_size, max_packet_size, False)
                             state = 1
-                        elif data != None and data[4] == fvc_protocol.data_types.TYPE_NACK:
-                            state = 2
-                            retransfers_counter += 1
                         else:
-                            endEvent.set()
+                            state = 2
                     else:
+                        link_stats["timeouts"] += 1
                         endEvent.set()
+                else:
+                    endEvent.set()
     
     if update_status:
         endEvent.clear()
         data = parseData(rxQueueu, endEvent, timeout=_timeout_for_end_of_update)
         if data != None and data[4] == fvc_protocol.data_types.TYPE_PROGRAM_UPDATE_FINISHED:
             print("Update finished for board with ID:", boardID," (Took:", (time.time_ns() - timer_start)/1000000 ,"ms)")
+            print("Link statistics for board with ID:", boardID, "host:", link_stats, "board:", queryLinkStatus(boardID, txQueue, rxQueueu, endEvent) if adaptive else None)
             return
     
     print("Update failed for board with ID:", boardID," (Took:", (time.time_ns() - timer_start)/1000000 ,"ms)")
 
+def pollMulticastStatus(boardID: int, txQueue: Queue, rxQueue: Queue, endEvent: Event, timeout = _multicast_status_timeout_ns):
+    txQueue.put(fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_PROGRAM_MULTICAST_STATUS, int(boardID), b''))
+    return parseData(rxQueue, endEvent, timeout)
+
+def multicastPacketGap(frame_len: int, packet_size: int, baudrate: int, addressMark: bool) -> float:
+    # address-mark frame is preceded by address character, boards receive it blocking and then program all its pages
+    if addressMark:
+        wire_time = (frame_len + 1) * (_multicast_char_bits + 1) / baudrate
+    else:
+        wire_time = frame_len * _multicast_char_bits / baudrate
+    program_time = ((packet_size + 255) // 256) * _w25q_page_program_max_s
+    return wire_time + program_time
+
+def multicastUpdateProcess(boardsID: list, boardsInfo: dict, programPath: str, baudrate: int, groupTxQueue: Queue, rxQueuesDict: dict, updateEndEventDict: dict, groupEndEvent: Event):
+    timer_start = time.time_ns()
+    
+    with open(programPath, "rb") as file:
+        program_data = file.read()
+    
+    hmac_sha = hmac_calc(program_data, _hmac_key)
+    packet_size = choosePacketSize([boardsInfo[id] for id in boardsID])
+    packets = [program_data[pos:pos + packet_size] for pos in range(0, len(program_data), packet_size)]
+    addressMark = bool(boardsInfo[boardsID[0]].get("capabilities", 0) & fvc_protocol.capabilities.CAPABILITY_ADDRESS_MARK)
+    flags = fvc_protocol.update_flags.UPDATE_FLAG_MULTICAST
+    
+    # join phase, each board answers to its own request
+    joined = []
+    for id in boardsID:
+        groupTxQueue.put(fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_PROGRAM_UPDATE_REQUEST, int(id), pack(">LL32sBLBH", 1, len(packets), hmac_sha, flags, 0, _multicast_group_id, packet_size)))
+        data = parseData(rxQueuesDict[id], updateEndEventDict[id])
+        if data != None and data[4] == fvc_protocol.data_types.TYPE_ACK:
+            joined.append(id)
+        else:
+            print("Board with ID:", id, "did not join multicast group")
+    
+    if len(joined) == 0:
+        return
+    
+    time.sleep(_multicast_erase_time_s)
+    
+    # stream phase, only packets missed by any board are resent
+    missing = set(range(len(packets)))
+    for round in range(_multicast_max_rounds):
+        if groupEndEvent.is_set():
+            return
+        
+        for seq in sorted(missing):
+            frame = fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_PROGRAM_MULTICAST_DATA, _multicast_group_id, pack(">H", seq) + packets[seq])
+            groupTxQueue.put(frame)
+            time.sleep(multicastPacketGap(len(frame), packet_size, baudrate, addressMark))
+        
+        missing = set()
+        for id in list(joined):
+            data = pollMulticastStatus(id, groupTxQueue, rxQueuesDict[id], updateEndEventDict[id])
+            if data == None or data[4] != fvc_protocol.data_types.TYPE_PROGRAM_MULTICAST_STATUS:
+                data = pollMulticastStatus(id, groupTxQueue, rxQueuesDict[id], updateEndEventDict[id])
+            
+            if data != None and data[4] == fvc_protocol.data_types.TYPE_PROGRAM_MULTICAST_STATUS:
+                bitmap = data[5]
+                missing |= {seq for seq in range(len(packets)) if bitmap[seq // 8] & (1 << (seq % 8))}
+            else:
+                print("Board with ID:", id, "left multicast group")
+                joined.remove(id)
+        
+        print("Multicast round", round, "missing packets:", len(missing))
+        if len(missing) == 0:
+            break
+    
+    if len(missing) > 0:
+        print("Multicast update failed, packets still missing after", _multicast_max_rounds, "rounds")
+        return
+    
+    # commit phase, boards flash targets in parallel and are polled for result
+    groupTxQueue.put(fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_PROGRAM_MULTICAST_COMMIT, _multicast_group_id, b''))
+    
+    timeout = time.time_ns() + _timeout_for_end_of_update
+    pending = list(joined)
+    while len(pending) > 0 and timeout > time.time_ns() and not groupEndEvent.is_set():
+        for id in list(pending):
+            data = pollMulticastStatus(id, groupTxQueue, rxQueuesDict[id], updateEndEventDict[id])
+            if data != None and data[4] == fvc_protocol.data_types.TYPE_PROGRAM_UPDATE_FINISHED:
+                print("Update finished for board with ID:", id," (Took:", (time.time_ns() - timer_start)/1000000 ,"ms)")
+                pending.remove(id)
+            elif data != None and data[4] == fvc_protocol.data_types.TYPE_FATAL_ERROR:
+                print("Update failed for board with ID:", id," (Took:", (time.time_ns() - timer_start)/1000000 ,"ms)")
+                pending.remove(id)
+    
+    for id in pending:
+        print("Update failed for board with ID:", id," (Took:", (time.time_ns() - timer_start)/1000000 ,"ms)")
+
 def parseDataProcess(uartQueueRx: Queue, uartQueueTx: Queue, updateQueueDictRx: dict, updateQueueDictTx: dict, endEvent: Event, cliQueueRx: Queue, cliQueueTx: Queue):
     boards_id = updateQueueDictRx.keys()
+    debug_types = (fvc_protocol.data_types.TYPE_CLI_DATA, fvc_protocol.data_types.TYPE_LOG_DATA)
+
+    try:
+        log_strings = fvc_log.load_strings(_log_elf_path)
+    except OSError:
+        log_strings = None
+        print("Firmware ELF not found, log records are printed raw")
 
     while not endEvent.is_set():
         if not uartQueueRx.empty():
             data = uartQueueRx.get()
             packet = fvc_protocol.deserialzie_packet(data)
             if packet != None:
-                if int(packet[2]) in boards_id and packet[4] != fvc_protocol.data_types.TYPE_CLI_DATA:
+                if int(packet[2]) in boards_id and packet[4] not in debug_types:
                     updateQueueDictRx[int(packet[2])].put(data)
                 elif packet[4] == fvc_protocol.data_types.TYPE_CLI_DATA:
                     print("[Debug] (", packet[2], "->", packet[3] ,")",packet[5:-1])
+                elif packet[4] == fvc_protocol.data_types.TYPE_LOG_DATA:
+                    (dropped, records) = fvc_log.decode(packet[5], log_strings)
+                    if dropped:
+                        print("[Log] (", packet[2], ")", dropped, "records dropped")
+                    for (tick, text) in records:
+                        print("[Log] (", packet[2], "@", tick, "ms)", text.rstrip())
                 else:
                     print("Unhandled data (", packet[2], "->", packet[3] ,")",packet[4:-1])
                 
@@ -121,16 +392,75 @@ def parseDataProcess(uartQueueRx: Queue, uartQueueTx: Queue, updateQueueDictRx:
                 data = updateQueueDictTx[id].get()
                 uartQueueTx.put(data)
 
-def updateManagerProcess(paralelUpdateEn: bool, boardsToUpdate: list, programPath: str, txQueuesDict: dict, rxQueuesDict: dict, updateEndEventDict: dict):
+def switchBaudrate(boardID: int, baudrate: int, currentBaudrate: int, txQueue: Queue, rxQueue: Queue, endEvent: Event) -> bool:
+    txQueue.put(fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_BAUD_SWITCH_REQUEST, int(boardID), pack(">L", baudrate)))
+    data = parseData(rxQueue, endEvent, timeout=_baud_switch_timeout_ns)
+    if data == None or data[4] != fvc_protocol.data_types.TYPE_ACK:
+        return False
+    
+    # probe at new rate confirms the switch, board reverts on its own if it does not arrive
+    txQueue.put(("baudrate", baudrate))
+    txQueue.put(fvc_protocol.serialize_packet(fvc_protocol.data_types.TYPE_BAUD_SWITCH_PROBE, int(boardID), b''))
+    data = parseData(rxQueue, endEvent, timeout=_baud_switch_timeout_ns)
+    if data != None and data[4] == fvc_protocol.data_types.TYPE_ACK:
+        return True
+    
+    txQueue.put(("baudrate", currentBaudrate))
+    return False
+
+def switchBusBaudrate(boardsID: list, baudrate: int, currentBaudrate: int, txQueuesDict: dict, rxQueuesDict: dict, updateEndEventDict: dict) -> bool:
+    # whole bus has to run at one rate, host returns to current rate before each request
+    switched = []
+    for id in boardsID:
+        txQueuesDict[id].put(("baudrate", currentBaudrate))
+        if not switchBaudrate(id, baudrate, currentBaudrate, txQueuesDict[id], rxQueuesDict[id], updateEndEventDict[id]):
+            print("Board with ID:", id, "refused", baudrate, "baud")
+            break
+        switched.append(id)
+    
+    if len(switched) == len(boardsID):
+        print("Bus switched to", baudrate, "baud")
+        return True
+    
+    # bring already switched boards back
+    for id in switched:
+        txQueuesDict[id].put(("baudrate", baudrate))
+        switchBaudrate(id, currentBaudrate, baudrate, txQueuesDict[id], rxQueuesDict[id], updateEndEventDict[id])
+    txQueuesDict[boardsID[0]].put(("baudrate", currentBaudrate))
+    return False
+
+def updateWithBaudrate(boardsID: list, boardsInfo: dict, update, txQueuesDict: dict, rxQueuesDict: dict, updateEndEventDict: dict):
+    # boards fall back to default rate when idle, so the rate is switched only for boards being updated
+    baudrate = min([_update_baudrate] + [boardsInfo[id]["max_baudrate"] for id in boardsID])
+    switched = baudrate > _baudrate and switchBusBaudrate(boardsID, baudrate, _baudrate, txQueuesDict, rxQueuesDict, updateEndEventDict)
+    update(baudrate if switched else _baudrate)
+    if switched:
+        for id in boardsID:
+            updateEndEventDict[id].clear()
+        switchBusBaudrate(boardsID, _baudrate, baudrate, txQueuesDict, rxQueuesDict, updateEndEventDict)
+
+def updateManagerProcess(paralelUpdateEn: bool, multicastUpdateEn: bool, boardsToUpdate: list, programPath: str, basePath: str, txQueuesDict: dict, rxQueuesDict: dict, updateEndEventDict: dict):
     processList = []
     
     if len(boardsToUpdate) == 0:
         return
     
+    boardsInfo = {id: queryBoardInfo(id, txQueuesDict[id], rxQueuesDict[id], updateEndEventDict[id]) for id in boardsToUpdate}
+    multicastSupported = all(boardsInfo[id]["update_flags"] & fvc_protocol.update_flags.UPDATE_FLAG_MULTICAST for id in boardsToUpdate)
+    # group stream uses one framing for all boards
+    addressMark = [bool(boardsInfo[id].get("capabilities", 0) & fvc_protocol.capabilities.CAPABILITY_ADDRESS_MARK) for id in boardsToUpdate]
+    multicastSupported = multicastSupported and len(set(addressMark)) == 1
+    
+    # one data stream for all boards, delta updates depend on each board's base image
+    if multicastUpdateEn and multicastSupported and len(boardsToUpdate) > 1 and basePath == None:
+        txQueuesDict[_multicast_group_id].put(("address_mark", _multicast_group_id, addressMark[0]))
+        updateWithBaudrate(boardsToUpdate, boardsInfo, lambda baudrate: multicastUpdateProcess(boardsToUpdate, boardsInfo, programPath, baudrate, txQueuesDict[_multicast_group_id], rxQueuesDict, updateEndEventDict, updateEndEventDict[_multicast_group_id]), txQueuesDict, rxQueuesDict, updateEndEventDict)
+        return
+    
     for id in boardsToUpdate:
-        processList.append(Process(target=boardUpdateProcess, args=(int(id), programPath, txQueuesDict[id], rxQueuesDict[id], updateEndEventDict[id])))
+        processList.append(Process(target=boardUpdateProcess, args=(int(id), boardsInfo[id], programPath, basePath, txQueuesDict[id], rxQueuesDict[id], updateEndEventDict[id])))
     
-    if paralelUpdateEn: # updating all boards at th same time 
+    def runParallel(baudrate: int):
         # start processes
         for proc in processList:
             proc.start()
@@ -138,10 +468,12 @@ def updateManagerProcess(paralelUpdateEn: bool, boardsToUpdate: list, programPat
         # wait for all updates to be completed or not responding
         for proc in processList: # skip serial port and parser processes
             proc.join()
+    
+    if paralelUpdateEn: # updating all boards at th same time 
+        updateWithBaudrate(boardsToUpdate, boardsInfo, runParallel, txQueuesDict, rxQueuesDict, updateEndEventDict)
     else: # updating one board at a time
-        for proc in processList: 
-            proc.start()
-            proc.join()
+        for id, proc in zip(boardsToUpdate, processList): 
+            updateWithBaudrate([id], boardsInfo, lambda baudrate: (proc.start(), proc.join()), txQueuesDict, rxQueuesDict, updateEndEventDict)
 
 
 def handleCli(txQueue: Queue, rxQueue: Queue, endEvent: Event):
@@ -153,7 +485,7 @@ def handleCli(txQueue: Queue, rxQueue: Queue, endEvent: Event):
             # print("[CLI]: ", data)
             pass
         
-def main(paralelUpdateEn: bool): 
+def main(paralelUpdateEn: bool, multicastUpdateEn: bool): 
     # start manager
     managerHandle = Manager()
     
@@ -175,7 +507,7 @@ def main(paralelUpdateEn: bool):
     input_args = sys.argv[1:]
     
     if len(input_args) < 2:
-        print("ERROR: Not enough arguments\nUsage: main.py boards_id.txt program.bin") 
+        print("ERROR: Not enough arguments\nUsage: main.py boards_id.txt program.bin [base_program.bin]") 
         return
     
     with open(input_args[0], "r") as boards:
@@ -187,12 +519,18 @@ def main(paralelUpdateEn: bool):
                 print("Cannot add ID: 0")
     
     program_path = input_args[1]
+    base_path = input_args[2] if len(input_args) > 2 else None
     
     for id in boards_to_update:
         txQueuesDict[int(id)] = managerHandle.Queue(100)
         rxQueuesDict[int(id)] = managerHandle.Queue(100)
         updateEndEventDict[int(id)] = managerHandle.Event()
     
+    if multicastUpdateEn:
+        txQueuesDict[_multicast_group_id] = managerHandle.Queue(100)
+        rxQueuesDict[_multicast_group_id] = managerHandle.Queue(100)
+        updateEndEventDict[_multicast_group_id] = managerHandle.Event()
+    
     # serila port process
     serialPortRxQueue = managerHandle.Queue(100)
     serialPortTxQueue = managerHandle.Queue(100)
@@ -208,7 +546,7 @@ def main(paralelUpdateEn: bool):
     parserCloseEvent = managerHandle.Event()
     parserProcessHandle = Process(target=parseDataProcess,args=(serialPortRxQueue,serialPortTxQueue,rxQueuesDict,txQueuesDict, parserCloseEvent, cliRxQueue, cliTxQueue))
     
-    updateManagerProcessHandle = Process(target=updateManagerProcess, args=(paralelUpdateEn, boards_to_update, program_path, txQueuesDict, rxQueuesDict, updateEndEventDict))
+    updateManagerProcessHandle = Process(target=updateManagerProcess, args=(paralelUpdateEn, multicastUpdateEn, boards_to_update, program_path, base_path, txQueuesDict, rxQueuesDict, updateEndEventDict))
     
     # starting uart, parser and CLI processes
     print("Starting main processes.")
@@ -238,4 +576,4 @@ def main(paralelUpdateEn: bool):
     print("Update statistics")
     
 if __name__ == "__main__":
-    main(False)
\ No newline at end of file
+    main(False, True)
\ No newline at end of file
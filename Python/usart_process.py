@@ -1,12 +1,32 @@
 from multiprocessing import Process, Queue, Event
-from serial import Serial
+from serial import Serial, PARITY_MARK, PARITY_SPACE, PARITY_NONE
 
 from fvc_protocol import get_packet_len, serialize_packet, deserialzie_packet, data_types
 
 import time
 
+# boards advertising CAPABILITY_ADDRESS_MARK use 9-bit address-mark framing, 9th bit is emulated with mark/space parity
+# other boards use plain 8N1, destinations are switched with ("address_mark", id, enable) requests
+
+def writeAddressedFrame(ser: Serial, frame: bytes):
+    # address character with 9th bit set wakes up only destination board
+    # parity can be changed only after it left the port, board skips idle line between them
+    ser.flush()
+    ser.parity = PARITY_MARK
+    ser.write(bytes([frame[4]]))
+    ser.flush()
+    ser.parity = PARITY_SPACE
+    ser.write(frame)
+
+def writePlainFrame(ser: Serial, frame: bytes):
+    if ser.parity != PARITY_NONE:
+        ser.flush()
+        ser.parity = PARITY_NONE
+    ser.write(frame)
+
 def SerialProcess(tx_queue: Queue, rx_queue: Queue, stop_event: Event, _port: str, _baudrate: int): 
-    ser = Serial(port=_port, baudrate=_baudrate)
+    ser = Serial(port=_port, baudrate=_baudrate, parity=PARITY_NONE)
+    addressMarkIDs = set()
     if not ser.is_open:
         ser.open()
         
@@ -20,7 +40,20 @@ def SerialProcess(tx_queue: Queue, rx_queue: Queue, stop_event: Event, _port: st
                     rx_queue.put(data, block=True, timeout=0.1)
                     
         if not tx_queue.empty():
-            ser.write(tx_queue.get(block=True, timeout=0.1))
+            data = tx_queue.get(block=True, timeout=0.1)
+            if isinstance(data, tuple) and data[0] == "baudrate": # switch request, keeps order with frames
+                ser.flush()
+                ser.baudrate = data[1]
+                time.sleep(0.01) # let board finish its own switch
+            elif isinstance(data, tuple) and data[0] == "address_mark":
+                if data[2]:
+                    addressMarkIDs.add(data[1])
+                else:
+                    addressMarkIDs.discard(data[1])
+            elif data[4] in addressMarkIDs:
+                writeAddressedFrame(ser, data)
+            else:
+                writePlainFrame(ser, data)
 
     ser.close()
 
@@ -17,6 +17,19 @@ void bsp_delay_ms(uint32_t time_ms)
 	HAL_Delay(time_ms);
 }
 
+// DWT cycle counter, used to measure cost of processing on target
+void bsp_cycle_counter_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t bsp_get_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+
 // ---------------------------------------------------------------------------------
 // GPIO support functions
 
@@ -103,18 +116,101 @@ bool bsp_bootloader_receive(uint8_t * data, size_t max_data_len)
 	return status;
 }
 
+static volatile bool bootloader_dma_busy = false;
+static volatile bool bootloader_dma_error = false;
+static bool bootloader_dma_callbacks_registered = false;
+
+static void bootloader_dma_tx_cplt_func(SPI_HandleTypeDef *hspi)
+{
+	if (hspi == BOOTLOADER_SUPERVISOR_SPI_PTR)
+	{
+		bootloader_dma_busy = false;
+	}
+}
+
+static void bootloader_dma_error_func(SPI_HandleTypeDef *hspi)
+{
+	if (hspi == BOOTLOADER_SUPERVISOR_SPI_PTR)
+	{
+		bootloader_dma_error = true;
+		bootloader_dma_busy = false;
+	}
+}
+
+bool bsp_bootloader_transmit_DMA(uint8_t * data, size_t data_len)
+{
+	if (bootloader_dma_busy)
+	{
+		return false;
+	}
+
+	// callbacks are reset to the HAL defaults every time SPI2 is reinitialized
+	if (!bootloader_dma_callbacks_registered)
+	{
+		HAL_SPI_RegisterCallback(BOOTLOADER_SUPERVISOR_SPI_PTR, HAL_SPI_TX_COMPLETE_CB_ID, bootloader_dma_tx_cplt_func);
+		HAL_SPI_RegisterCallback(BOOTLOADER_SUPERVISOR_SPI_PTR, HAL_SPI_ERROR_CB_ID, bootloader_dma_error_func);
+		bootloader_dma_callbacks_registered = true;
+	}
+
+	bootloader_dma_error = false;
+	bootloader_dma_busy = true;
+
+	if (HAL_SPI_Transmit_DMA(BOOTLOADER_SUPERVISOR_SPI_PTR, data, data_len) != HAL_OK)
+	{
+		bootloader_dma_busy = false;
+		return false;
+	}
+
+	return true;
+}
+
+bool bsp_bootloader_wait_for_DMA(uint32_t timeout)
+{
+	uint32_t tick_start = HAL_GetTick();
+
+	while (bootloader_dma_busy)
+	{
+		if ((HAL_GetTick() - tick_start) > timeout)
+		{
+			HAL_SPI_Abort(BOOTLOADER_SUPERVISOR_SPI_PTR);
+			bootloader_dma_busy = false;
+			return false;
+		}
+	}
+
+	return !bootloader_dma_error;
+}
+
 // ----------------------------------------------------------------------------------
 // Supervisor interface
 
 #define BOOTLOADER_SUPERVISOR_TIMER_PTR 	&htim1
 
+/*
+ * TIM1 counts down 1 us ticks, 16-bit counter is extended in software:
+ * period is split into first chunk loaded into counter and full 65536 us chunks reloaded from ARR
+ */
+#define SUPERVISOR_TIMER_CHUNK_US	65536UL
+
 static void (*timer_handler_ptr)(void) = NULL;
+static volatile uint32_t timer_chunks_left = 0;
+static volatile uint32_t timer_elapsed_us = 0;		// finished chunks of current run
+static volatile uint32_t timer_chunk_us = 0;		// length of running chunk
 
 static void timer_handler_func(TIM_HandleTypeDef *htim)
 {
 	if (htim == BOOTLOADER_SUPERVISOR_TIMER_PTR)
 	{
-		timer_handler_ptr();
+		timer_elapsed_us += timer_chunk_us;
+		timer_chunk_us = SUPERVISOR_TIMER_CHUNK_US;
+
+		if (timer_chunks_left == 0)
+		{
+			HAL_TIM_Base_Stop_IT(BOOTLOADER_SUPERVISOR_TIMER_PTR);
+			timer_handler_ptr();
+			return;
+		}
+		timer_chunks_left--;
 	}
 }
 
@@ -124,41 +220,95 @@ void bsp_timer_init(void (*handler)())
 	HAL_TIM_RegisterCallback(BOOTLOADER_SUPERVISOR_TIMER_PTR, HAL_TIM_PERIOD_ELAPSED_CB_ID, timer_handler_func);
 }
 
-bool bsp_spi_transmit(uint8_t *data, uint16_t len, uint32_t timeout)
+static void (*spi_handler_ptr)(bool) = NULL;
+
+static void spi_cplt_func(SPI_HandleTypeDef *hspi)
+{
+	if ((hspi == BOOTLOADER_SUPERVISOR_SPI_PTR) && (spi_handler_ptr != NULL))
+	{
+		spi_handler_ptr(true);
+	}
+}
+
+static void spi_error_func(SPI_HandleTypeDef *hspi)
+{
+	if ((hspi == BOOTLOADER_SUPERVISOR_SPI_PTR) && (spi_handler_ptr != NULL))
+	{
+		spi_handler_ptr(false);
+	}
+}
+
+static void _spi_register_callbacks(void)
+{
+	HAL_SPI_RegisterCallback(BOOTLOADER_SUPERVISOR_SPI_PTR, HAL_SPI_TX_COMPLETE_CB_ID, spi_cplt_func);
+	HAL_SPI_RegisterCallback(BOOTLOADER_SUPERVISOR_SPI_PTR, HAL_SPI_RX_COMPLETE_CB_ID, spi_cplt_func);
+	HAL_SPI_RegisterCallback(BOOTLOADER_SUPERVISOR_SPI_PTR, HAL_SPI_ERROR_CB_ID, spi_error_func);
+}
+
+// callbacks are registered in bsp_supervisor_init, only slave transfers report completion
+void bsp_spi_init(void (*handler)(bool))
 {
-    if(HAL_SPI_Transmit(BOOTLOADER_SUPERVISOR_SPI_PTR, data, len, timeout) != HAL_OK)
-    {
-        return false;
-    }
-    else
-    {
-        return true;
-    }
+	spi_handler_ptr = handler;
 }
 
-bool bsp_spi_receive(uint8_t *data, uint16_t len, uint32_t timeout)
+bool bsp_spi_transmit_IT(uint8_t *data, uint16_t len)
 {
-    if(HAL_SPI_Receive(BOOTLOADER_SUPERVISOR_SPI_PTR, data, len, timeout) != HAL_OK)
-    {
-        return false;
-    }
-    else
-    {
-        return true;
-    }
+	return HAL_SPI_Transmit_IT(BOOTLOADER_SUPERVISOR_SPI_PTR, data, len) == HAL_OK;
+}
+
+bool bsp_spi_receive_IT(uint8_t *data, uint16_t len)
+{
+	return HAL_SPI_Receive_IT(BOOTLOADER_SUPERVISOR_SPI_PTR, data, len) == HAL_OK;
+}
+
+void bsp_spi_abort(void)
+{
+	HAL_SPI_Abort(BOOTLOADER_SUPERVISOR_SPI_PTR);
+}
+
+void bsp_timer_start_refresh(uint32_t period_us)
+{
+	if (period_us == 0)
+	{
+		period_us = 1;
+	}
+
+	HAL_TIM_Base_Stop_IT(BOOTLOADER_SUPERVISOR_TIMER_PTR);
+
+	timer_chunks_left = (period_us - 1) / SUPERVISOR_TIMER_CHUNK_US;
+	timer_chunk_us = period_us - timer_chunks_left * SUPERVISOR_TIMER_CHUNK_US;
+	timer_elapsed_us = 0;
+
+	// down counter underflows after (counter + 1) ticks
+	__HAL_TIM_SET_COUNTER(BOOTLOADER_SUPERVISOR_TIMER_PTR, timer_chunk_us - 1);
+	__HAL_TIM_CLEAR_FLAG(BOOTLOADER_SUPERVISOR_TIMER_PTR, TIM_FLAG_UPDATE);
+	HAL_TIM_Base_Start_IT(BOOTLOADER_SUPERVISOR_TIMER_PTR);
 }
 
-void bsp_timer_start_refresh(uint32_t period)
+uint32_t bsp_timer_get_elapsed_us(void)
 {
-    HAL_TIM_Base_Start_IT(BOOTLOADER_SUPERVISOR_TIMER_PTR);
-    if(period > 65535)
-    {
-        __HAL_TIM_SET_COUNTER(BOOTLOADER_SUPERVISOR_TIMER_PTR, 65535);
-    }
-    else
-    {
-        __HAL_TIM_SET_COUNTER(BOOTLOADER_SUPERVISOR_TIMER_PTR, period);
-    }
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	uint32_t elapsed = timer_elapsed_us;
+	uint32_t chunk = timer_chunk_us;
+	uint32_t counter = __HAL_TIM_GET_COUNTER(BOOTLOADER_SUPERVISOR_TIMER_PTR);
+
+	// underflow not handled by interrupt yet, counter is already reloaded
+	if (__HAL_TIM_GET_FLAG(BOOTLOADER_SUPERVISOR_TIMER_PTR, TIM_FLAG_UPDATE))
+	{
+		counter = __HAL_TIM_GET_COUNTER(BOOTLOADER_SUPERVISOR_TIMER_PTR);
+		elapsed += chunk;
+		chunk = SUPERVISOR_TIMER_CHUNK_US;
+	}
+
+	__set_PRIMASK(primask);
+
+	if (chunk == 0)
+	{
+		return elapsed;
+	}
+	return elapsed + (chunk - 1 - counter);
 }
 
 bool bsp_timer_stop(void)
@@ -169,6 +319,7 @@ bool bsp_timer_stop(void)
 void bsp_updater_init(void)
 {
 	HAL_SPI_DeInit(&hspi2);
+	bootloader_dma_callbacks_registered = false;
 
 	hspi2.Instance = SPI2;
 	hspi2.Init.Mode = SPI_MODE_MASTER;
@@ -193,6 +344,7 @@ void bsp_updater_init(void)
 void bsp_supervisor_init(void)
 {
 	HAL_SPI_DeInit(&hspi2);
+	bootloader_dma_callbacks_registered = false;
 
 	hspi2.Instance = SPI2;
 	hspi2.Init.Mode = SPI_MODE_SLAVE;
@@ -211,6 +363,9 @@ void bsp_supervisor_init(void)
 	{
 		Error_Handler();
 	}
+
+	// callbacks are reset to the HAL defaults every time SPI2 is reinitialized
+	_spi_register_callbacks();
 }
 
 // ----------------------------------------------------------------------------------
@@ -218,12 +373,81 @@ void bsp_supervisor_init(void)
 
 #define INTERFACE_UART_PTR &huart1
 
+#define INTERFACE_MIN_BAUDRATE		9600
+
+#define INTERFACE_TX_MAX_WORDS		512
+#define INTERFACE_RX_TIMEOUT		3000	// ms
+
+// driver enable timing as set by MX_USART1_UART_Init, in sample time units
+#define INTERFACE_DE_ASSERTION_TIME		0
+#define INTERFACE_DE_DEASSERTION_TIME	0
+
 static void (*handler_ptr)(size_t) = NULL;
+static void (*interface_tx_handler_ptr)(bool) = NULL;
+
+// UART re-init clears FIFOEN and thresholds while handle still selects FIFO reception ISR
+static bool _interface_fifo_configure(void)
+{
+	return (HAL_UARTEx_SetTxFifoThreshold(INTERFACE_UART_PTR, UART_TXFIFO_THRESHOLD_1_8) == HAL_OK)
+			&& (HAL_UARTEx_SetRxFifoThreshold(INTERFACE_UART_PTR, UART_RXFIFO_THRESHOLD_1_8) == HAL_OK)
+			&& (HAL_UARTEx_EnableFifoMode(INTERFACE_UART_PTR) == HAL_OK);
+}
+
+// USART1 TX DMA channel moves half-words, frame bytes are expanded before transfer starts
+static uint16_t interface_tx_words[INTERFACE_TX_MAX_WORDS];
+static volatile bool interface_tx_pending = false;
+
+#if BSP_INTERFACE_ADDRESS_MARK
+/*
+ * USART1 works with 9-bit words in mute mode. Host precedes every frame with
+ * address character (9th bit set), only board with matching address wakes up
+ * and receives frame bytes. Address characters are stripped before data is
+ * passed to protocol layer, board responses are sent as plain data words.
+ */
+#define INTERFACE_ADDRESS_MARK		0x100
+#define INTERFACE_RX_MAX_WORDS		(4*1024 + 512)	// program frame with FEC parity
 
+// shared by blocking and IT reception, only one of them is active at a time
+static uint16_t interface_rx_words[INTERFACE_RX_MAX_WORDS];
+
+static uint8_t *interface_rx_data = NULL;
+static size_t interface_rx_len = 0;
+static uint8_t interface_address = 0;
+
+static bool _interface_configure(void)
+{
+	// 8-bit address is compared in 9-bit data mode when 7-bit detection is selected
+	(INTERFACE_UART_PTR)->Init.WordLength = UART_WORDLENGTH_9B;
+	return (HAL_MultiProcessor_Init(INTERFACE_UART_PTR, interface_address, UART_WAKEUPMETHOD_ADDRESSMARK) == HAL_OK)
+			&& (HAL_MultiProcessorEx_AddressLength_Set(INTERFACE_UART_PTR, UART_ADDRESS_DETECT_7B) == HAL_OK)
+			&& _interface_fifo_configure()
+			&& bsp_interface_mute_control(true);
+}
+
+static size_t _interface_unpack_words(uint8_t *data, size_t data_len, size_t words_len)
+{
+	size_t len = 0;
+
+	for (size_t i = 0; (i < words_len) && (len < data_len); i++)
+	{
+		if (!(interface_rx_words[i] & INTERFACE_ADDRESS_MARK))
+		{
+			data[len++] = (uint8_t) interface_rx_words[i];
+		}
+	}
+	return len;
+}
+
+static void handler_func(struct __UART_HandleTypeDef * ptr, short unsigned int len)
+{
+	handler_ptr(_interface_unpack_words(interface_rx_data, interface_rx_len, (size_t) len));
+}
+#else
 static void handler_func(struct __UART_HandleTypeDef * ptr, short unsigned int len)
 {
 	handler_ptr((size_t) len);
 }
+#endif
 
 void bsp_interface_init(void (*handler)())
 {
@@ -235,33 +459,234 @@ void bsp_interface_init(void (*handler)())
 	}
 }
 
-bool bsp_interface_transmit(uint8_t* data, size_t data_len)
+#if BSP_INTERFACE_ADDRESS_MARK
+bool bsp_interface_set_address(uint8_t address)
 {
-	return HAL_UART_Transmit(INTERFACE_UART_PTR, (uint8_t*)data, data_len, 100) == HAL_OK;
+	HAL_UART_AbortReceive(INTERFACE_UART_PTR);
+
+	interface_address = address;
+	if (!_interface_configure())
+	{
+		return false;
+	}
+
+	if (interface_rx_data != NULL)
+	{
+		return bsp_interface_receive_IT(interface_rx_data, interface_rx_len);
+	}
+	return true;
+}
+
+bool bsp_interface_mute_control(bool enable)
+{
+	if (!enable)
+	{
+		return HAL_MultiProcessor_DisableMuteMode(INTERFACE_UART_PTR) == HAL_OK;
+	}
+
+	if (HAL_MultiProcessor_EnableMuteMode(INTERFACE_UART_PTR) != HAL_OK)
+	{
+		return false;
+	}
+	HAL_MultiProcessor_EnterMuteMode(INTERFACE_UART_PTR);
+	return true;
 }
 
 bool bsp_interface_receive(uint8_t* data, size_t data_len)
 {
 	uint16_t temp;
-	return HAL_UARTEx_ReceiveToIdle(INTERFACE_UART_PTR, (uint8_t*)data, data_len, &temp, 3000) == HAL_OK;
+	uint32_t tick_start = HAL_GetTick();
+	uint32_t elapsed = 0;
+
+	// one extra word for address character
+	if (data_len + 1 > INTERFACE_RX_MAX_WORDS)
+	{
+		return false;
+	}
+
+	// host changes parity after address character, line goes idle before frame data follows
+	do
+	{
+		if ((elapsed >= INTERFACE_RX_TIMEOUT)
+				|| (HAL_UARTEx_ReceiveToIdle(INTERFACE_UART_PTR, (uint8_t*)interface_rx_words, data_len + 1, &temp, INTERFACE_RX_TIMEOUT - elapsed) != HAL_OK))
+		{
+			return false;
+		}
+		elapsed = HAL_GetTick() - tick_start;
+	} while (_interface_unpack_words(data, data_len, temp) == 0);
+
+	return true;
+}
+
+bool bsp_interface_receive_IT(uint8_t* data, size_t data_len)
+{
+	if (data_len + 1 > INTERFACE_RX_MAX_WORDS)
+	{
+		return false;
+	}
+
+	interface_rx_data = data;
+	interface_rx_len = data_len;
+	return HAL_UARTEx_ReceiveToIdle_IT(INTERFACE_UART_PTR, (uint8_t*)interface_rx_words, data_len + 1) == HAL_OK;
+}
+#else
+static bool _interface_configure(void)
+{
+	return (HAL_RS485Ex_Init(INTERFACE_UART_PTR, UART_DE_POLARITY_HIGH, INTERFACE_DE_ASSERTION_TIME, INTERFACE_DE_DEASSERTION_TIME) == HAL_OK)
+			&& _interface_fifo_configure();
+}
+
+bool bsp_interface_set_address(uint8_t address)
+{
+	return true;
+}
+
+bool bsp_interface_mute_control(bool enable)
+{
+	return true;
+}
+
+bool bsp_interface_receive(uint8_t* data, size_t data_len)
+{
+	uint16_t temp;
+	return HAL_UARTEx_ReceiveToIdle(INTERFACE_UART_PTR, (uint8_t*)data, data_len, &temp, INTERFACE_RX_TIMEOUT) == HAL_OK;
 }
 
 bool bsp_interface_receive_IT(uint8_t* data, size_t data_len)
 {
 	return HAL_UARTEx_ReceiveToIdle_IT(INTERFACE_UART_PTR, (uint8_t*)data, data_len) == HAL_OK;
 }
+#endif
 
 bool bsp_interface_abort_receive_IT(void)
 {
 	return HAL_UART_AbortReceive(INTERFACE_UART_PTR) == HAL_OK;
 }
 
+static void interface_tx_cplt_func(UART_HandleTypeDef *huart)
+{
+	interface_tx_pending = false;
+	interface_tx_handler_ptr(true);
+}
+
+// error callback is shared with reception, only errors which ended DMA transmission are reported
+static void interface_tx_error_func(UART_HandleTypeDef *huart)
+{
+	if (interface_tx_pending && (huart->gState == HAL_UART_STATE_READY))
+	{
+		interface_tx_pending = false;
+		interface_tx_handler_ptr(false);
+	}
+}
+
+void bsp_interface_tx_init(void (*handler)(bool))
+{
+	interface_tx_handler_ptr = handler;
+	HAL_UART_RegisterCallback(INTERFACE_UART_PTR, HAL_UART_TX_COMPLETE_CB_ID, interface_tx_cplt_func);
+	HAL_UART_RegisterCallback(INTERFACE_UART_PTR, HAL_UART_ERROR_CB_ID, interface_tx_error_func);
+}
+
+// data can be reused as soon as function returns, completion is reported to handler from interrupt
+bool bsp_interface_transmit_DMA(uint8_t* data, size_t data_len)
+{
+	if ((data_len == 0) || (data_len > INTERFACE_TX_MAX_WORDS))
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < data_len; i++)
+	{
+		interface_tx_words[i] = data[i];
+	}
+
+	interface_tx_pending = true;
+	if (HAL_UART_Transmit_DMA(INTERFACE_UART_PTR, (uint8_t*)interface_tx_words, data_len) != HAL_OK)
+	{
+		interface_tx_pending = false;
+		return false;
+	}
+	return true;
+}
+
+void bsp_interface_abort_transmit(void)
+{
+	HAL_UART_AbortTransmit(INTERFACE_UART_PTR);
+	interface_tx_pending = false;
+}
+
+bool bsp_interface_is_baudrate_supported(uint32_t baudrate)
+{
+	// 16x oversampling needs at least 16 kernel clock cycles per bit
+	return (baudrate >= INTERFACE_MIN_BAUDRATE) && (baudrate <= bsp_interface_get_max_baudrate());
+}
+
+uint32_t bsp_interface_get_max_baudrate(void)
+{
+	return HAL_RCC_GetPCLK2Freq() / 16;
+}
+
+uint32_t bsp_interface_get_baudrate(void)
+{
+	return (INTERFACE_UART_PTR)->Init.BaudRate;
+}
+
+// reception is left stopped, caller has to restart it at new rate
+bool bsp_interface_set_baudrate(uint32_t baudrate)
+{
+	if (!bsp_interface_is_baudrate_supported(baudrate))
+	{
+		return false;
+	}
+
+	HAL_UART_AbortReceive(INTERFACE_UART_PTR);
+
+	(INTERFACE_UART_PTR)->Init.BaudRate = baudrate;
+	return _interface_configure();
+}
+
 // ----------------------------------------------------------------------------------
 // DEBUG interface support functions
 
 #define DEBUG_INTERFACE_UART_PTR &huart3
 
-bool bsp_debug_interface_transmit(uint8_t* data, size_t data_len)
+static void (*debug_tx_handler_ptr)(bool) = NULL;
+static volatile bool debug_tx_pending = false;
+
+static void debug_tx_cplt_func(UART_HandleTypeDef *huart)
+{
+	debug_tx_pending = false;
+	debug_tx_handler_ptr(true);
+}
+
+static void debug_tx_error_func(UART_HandleTypeDef *huart)
 {
-	return HAL_UART_Transmit(DEBUG_INTERFACE_UART_PTR, (uint8_t*)data, data_len, 100) == HAL_OK;
+	if (debug_tx_pending && (huart->gState == HAL_UART_STATE_READY))
+	{
+		debug_tx_pending = false;
+		debug_tx_handler_ptr(false);
+	}
+}
+
+void bsp_debug_interface_tx_init(void (*handler)(bool))
+{
+	debug_tx_handler_ptr = handler;
+	HAL_UART_RegisterCallback(DEBUG_INTERFACE_UART_PTR, HAL_UART_TX_COMPLETE_CB_ID, debug_tx_cplt_func);
+	HAL_UART_RegisterCallback(DEBUG_INTERFACE_UART_PTR, HAL_UART_ERROR_CB_ID, debug_tx_error_func);
+}
+
+// data is read by DMA, it has to stay valid until handler is called
+bool bsp_debug_interface_transmit_DMA(uint8_t* data, size_t data_len)
+{
+	if (data_len == 0)
+	{
+		return false;
+	}
+
+	debug_tx_pending = true;
+	if (HAL_UART_Transmit_DMA(DEBUG_INTERFACE_UART_PTR, data, data_len) != HAL_OK)
+	{
+		debug_tx_pending = false;
+		return false;
+	}
+	return true;
 }
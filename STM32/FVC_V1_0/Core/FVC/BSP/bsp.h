@@ -5,6 +5,9 @@
 
 #include "main.h"
 
+// RS485 interface uses 9-bit address-mark framing, USART wakes up only for frames addressed to board
+#define BSP_INTERFACE_ADDRESS_MARK	1
+
 enum gpio_state {
 	GPIO_RESET = 0,
 	GPIO_SET,
@@ -13,6 +16,8 @@ enum gpio_state {
 };
 
 void bsp_delay_ms(uint32_t time_ms);
+void bsp_cycle_counter_init(void);
+uint32_t bsp_get_cycles(void);
 
 bool bsp_initi_gpio(void);
 bool bsp_boot0_gpio_controll(enum gpio_state state);
@@ -26,23 +31,37 @@ void bsp_led_timer_stop(void);
 
 bool bsp_bootloader_transmit(uint8_t * data, size_t data_len);
 bool bsp_bootloader_receive(uint8_t * data, size_t max_data_len);
+bool bsp_bootloader_transmit_DMA(uint8_t * data, size_t data_len);
+bool bsp_bootloader_wait_for_DMA(uint32_t timeout);
 
 void bsp_interface_init(void (*handler)());
-bool bsp_interface_transmit(uint8_t* data, size_t data_len);
+void bsp_interface_tx_init(void (*handler)(bool));
+bool bsp_interface_transmit_DMA(uint8_t* data, size_t data_len);
+void bsp_interface_abort_transmit(void);
 bool bsp_interface_receive(uint8_t* data, size_t data_len);
 bool bsp_interface_receive_IT(uint8_t* data, size_t data_len);
 bool bsp_interface_abort_receive_IT(void);
+bool bsp_interface_set_address(uint8_t address);
+bool bsp_interface_mute_control(bool enable);
+bool bsp_interface_is_baudrate_supported(uint32_t baudrate);
+uint32_t bsp_interface_get_max_baudrate(void);
+uint32_t bsp_interface_get_baudrate(void);
+bool bsp_interface_set_baudrate(uint32_t baudrate);
 
 void bsp_timer_init(void (*handler)());
 
-bool bsp_spi_transmit(uint8_t *data, uint16_t len, uint32_t timeout);
-bool bsp_spi_receive(uint8_t *data, uint16_t len, uint32_t timeout);
-void bsp_timer_start_refresh(uint32_t period);
+void bsp_spi_init(void (*handler)(bool));
+bool bsp_spi_transmit_IT(uint8_t *data, uint16_t len);
+bool bsp_spi_receive_IT(uint8_t *data, uint16_t len);
+void bsp_spi_abort(void);
+void bsp_timer_start_refresh(uint32_t period_us);
+uint32_t bsp_timer_get_elapsed_us(void);
 bool bsp_timer_stop(void);
 
 void bsp_updater_init(void);
 void bsp_supervisor_init(void);
 
-bool bsp_debug_interface_transmit(uint8_t* data, size_t data_len);
+void bsp_debug_interface_tx_init(void (*handler)(bool));
+bool bsp_debug_interface_transmit_DMA(uint8_t* data, size_t data_len);
 
 #endif
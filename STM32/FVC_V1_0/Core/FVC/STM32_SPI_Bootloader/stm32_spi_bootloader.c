@@ -19,6 +19,8 @@
 #define MAX_RESPONSE_RETRY				(MAX_RESPONSE_TIMEOUT/RESPONSE_RETRY_DELAY)
 #endif
 
+#define WRITE_DMA_TIMEOUT				100	// timeout in ms
+
 #define SYNCRONIZATION_BYTE				0x5A
 
 #define MAX_SUPPORTED_COMMANDS			32
@@ -57,6 +59,13 @@ enum bootloader_ret_val
 static uint8_t protocol_version = 0;
 static uint8_t supported_commands_list[MAX_SUPPORTED_COMMANDS];
 
+static uint8_t write_frame[1 + BOOTLOADER_MAX_READ_WRITE + 1];
+static bool write_pending = false;
+
+static enum bootloader_ret_val last_response = BOOTLOADER_ACK;
+
+static struct bootloader_session session = {0};
+
 static uint8_t _calc_checksum(uint8_t *data, size_t data_len)
 {
 	uint8_t checksum = 0x00;
@@ -131,6 +140,7 @@ static enum bootloader_ret_val _get_reponse_procedure(void)
 		}
 	}
 
+	last_response = status;
 	return status;
 }
 
@@ -239,8 +249,10 @@ __attribute__((unused)) static bool _set_read_unprotect(void)
 	return true;
 }
 
-__attribute__((unused)) static bool _get_version(uint8_t *version)
+static bool _get_version(uint8_t *version)
 {
+	uint8_t rx_data = 0;
+
 	if (!_send_command(GET_VERSION_COMMAND)) {
 		return false;
 	}
@@ -250,13 +262,19 @@ __attribute__((unused)) static bool _get_version(uint8_t *version)
 		return false;
 	}
 
-	bsp_bootloader_receive(&protocol_version, 1);
+	for (int var = 0; var < 3; ++var) {
+		bsp_bootloader_receive(&rx_data, 1);
+		if (rx_data != 0xA5) {
+			break;
+		}
+	}
 
 	if(_get_reponse_procedure() != BOOTLOADER_ACK)
 	{
 		return false;
 	}
 
+	*version = rx_data;
 	return true;
 }
 
@@ -379,16 +397,60 @@ bool erase_memory(uint16_t sectors_count, uint16_t sectors_begin)
 	return true;
 }
 
-bool write_memory(uint32_t addr, uint8_t *data, size_t data_len)
+bool erase_memory_pages(uint16_t *pages, uint16_t pages_count)
 {
-	if((data == NULL) || (data_len > BOOTLOADER_MAX_READ_WRITE))
+	if ((pages == NULL) || (pages_count == 0) || (pages_count >= 0xFFF0)) {
+		return false;
+	}
+
+	uint8_t data[2] = {(uint8_t)((pages_count - 1) >> 8), (uint8_t)(pages_count - 1)};
+	uint8_t checksum = _calc_checksum(data, 2);
+
+	if (!_send_command(ERASE_MEMORY_COMMAND)) {
+		return false;
+	}
+
+	if (_get_reponse_procedure() != BOOTLOADER_ACK) {
+		return false;
+	}
+
+	bsp_bootloader_transmit(data, 2);
+	bsp_bootloader_transmit(&checksum, 1);
+
+	if (_get_reponse_procedure() != BOOTLOADER_ACK) {
+		return false;
+	}
+
+	checksum = 0;
+	for (uint16_t i = 0; i < pages_count; i++) {
+		data[0] = (uint8_t)(pages[i] >> 8);
+		data[1] = (uint8_t)(pages[i]);
+		checksum = _calc_contnuus_checksum(checksum, data, 2);
+		bsp_bootloader_transmit(data, 2);
+	}
+	bsp_bootloader_transmit(&checksum, 1);
+
+	if (_get_reponse_procedure() != BOOTLOADER_ACK) {
+		return false;
+	}
+
+	return true;
+}
+
+bool write_memory_start(uint32_t addr, uint8_t *data, size_t data_len)
+{
+	if((data == NULL) || (data_len == 0) || (data_len > BOOTLOADER_MAX_READ_WRITE) || write_pending)
 	{
 		return false;
 	}
 
 	uint8_t addr_data[4] = SERIALIZE_ADDR(addr);
 	uint8_t checksum = _calc_checksum(addr_data, 4);
-	uint8_t len_data = data_len - 1;
+
+	// whole data phase (length, data, checksum) is staged here and sent as one DMA transfer
+	write_frame[0] = (uint8_t) (data_len - 1);
+	memcpy(&write_frame[1], data, data_len);
+	write_frame[data_len + 1] = _calc_contnuus_checksum(write_frame[0], data, data_len);
 
 	if (!_send_command(WRITE_MEMORY_COMMAND)) {
 		return false;
@@ -405,10 +467,27 @@ bool write_memory(uint32_t addr, uint8_t *data, size_t data_len)
 		return false;
 	}
 
-	checksum = _calc_contnuus_checksum(len_data, data, data_len);
-	bsp_bootloader_transmit(&len_data, 1);
-	bsp_bootloader_transmit(data, data_len);
-	bsp_bootloader_transmit(&checksum, 1);
+	if (!bsp_bootloader_transmit_DMA(write_frame, data_len + 2)) {
+		return false;
+	}
+
+	write_pending = true;
+	return true;
+}
+
+bool write_memory_finish(void)
+{
+	if (!write_pending)
+	{
+		return false;
+	}
+
+	write_pending = false;
+
+	if (!bsp_bootloader_wait_for_DMA(WRITE_DMA_TIMEOUT)) {
+		last_response = BOOTLOADER_TIMEOUT;
+		return false;
+	}
 
 	if (_get_reponse_procedure() != BOOTLOADER_ACK) {
 		return false;
@@ -417,8 +496,26 @@ bool write_memory(uint32_t addr, uint8_t *data, size_t data_len)
 	return true;
 }
 
+bool write_memory(uint32_t addr, uint8_t *data, size_t data_len)
+{
+	if (!write_memory_start(addr, data, data_len))
+	{
+		return false;
+	}
+
+	return write_memory_finish();
+}
+
+bool is_bootloader_connection_lost(void)
+{
+	return last_response == BOOTLOADER_TIMEOUT;
+}
+
 bool jmp_to_bootloader(void)
 {
+	session.active = false;
+	session.resets++;
+
 	if (!_bootloader_init_process())
 	{
 		return false;
@@ -428,6 +525,7 @@ bool jmp_to_bootloader(void)
 		return false;
 	}
 
+	session.active = true;
 	return true;
 }
 
@@ -451,5 +549,67 @@ bool jmp_to_app(uint32_t app_addr)
 		return false;
 	}
 
+	session.active = false;
 	return true;
 }
+
+bool bootloader_session_probe(void)
+{
+	uint8_t version = 0;
+
+	if (!session.active)
+	{
+		return false;
+	}
+
+	session.probes++;
+	if (!_get_version(&version) || (version != protocol_version))
+	{
+		session.active = false;
+		return false;
+	}
+
+	return true;
+}
+
+bool bootloader_session_open(void)
+{
+	if (bootloader_session_probe())
+	{
+		return true;
+	}
+
+	session.resets = 0;
+	session.retries = 0;
+	session.probes = 0;
+
+	return jmp_to_bootloader();
+}
+
+bool bootloader_session_recover(void)
+{
+	session.retries++;
+
+	// NACKed command means bootloader is still synchronised
+	if (session.active && !is_bootloader_connection_lost())
+	{
+		return true;
+	}
+
+	if (bootloader_session_probe())
+	{
+		return true;
+	}
+
+	return jmp_to_bootloader();
+}
+
+void bootloader_session_close(void)
+{
+	session.active = false;
+}
+
+const struct bootloader_session *bootloader_session_get(void)
+{
+	return &session;
+}
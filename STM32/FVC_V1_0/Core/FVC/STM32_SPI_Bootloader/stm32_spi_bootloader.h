@@ -7,15 +7,48 @@
 
 #define	STM32_FLASH_START_ADDR	0x08000000
 
+struct bootloader_session
+{
+	bool active;		// target is in system bootloader and synchronised
+	uint32_t resets;	// full BOOT0/RESET sequences
+	uint32_t retries;	// recoveries requested by callers
+	uint32_t probes;	// GET_VERSION round trips
+};
+
 // @note user can only read up to 256 bytes in one readout
 bool read_prog_memory(uint32_t addr, uint8_t *data, size_t data_len);
 
 // @note if sectors_count equals to 0xFFFF global mass erase will be performed
 bool erase_memory(uint16_t sectors_count, uint16_t sectors_begin);
 
+// @note erases pages given in list, pages do not have to be contiguous
+bool erase_memory_pages(uint16_t *pages, uint16_t pages_count);
+
 bool write_memory(uint32_t addr, uint8_t *data, size_t data_len);
 
+// @note split version of write_memory, data phase is sent by DMA between start and finish
+// @note data buffer can be reused as soon as write_memory_start returns
+bool write_memory_start(uint32_t addr, uint8_t *data, size_t data_len);
+bool write_memory_finish(void);
+
+// @note true if the last command was left without ACK/NACK, NACKed commands keep the connection
+bool is_bootloader_connection_lost(void);
+
 bool jmp_to_bootloader(void);
 bool jmp_to_app(uint32_t app_addr);
 
+// @note checks with GET_VERSION if target is still in its bootloader, without resetting it
+bool bootloader_session_probe(void);
+
+// @note reuses current session if probe succeeds, otherwise resets target into bootloader
+bool bootloader_session_open(void);
+
+// @note retry action for failed commands, target is reset only if connection was lost
+bool bootloader_session_recover(void);
+
+// @note must be called when target leaves bootloader outside of this module (e.g. reset)
+void bootloader_session_close(void);
+
+const struct bootloader_session *bootloader_session_get(void);
+
 #endif
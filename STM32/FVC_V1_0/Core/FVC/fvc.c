@@ -6,6 +6,13 @@
 #include "fvc_backup_management.h"
 #include "fvc_led.h"
 #include "fvc_supervisor.h"
+#include "fvc_delta.h"
+#include "fvc_lz.h"
+#include "fvc_fec.h"
+#include "fvc_scrubber.h"
+#include "fvc_scheduler.h"
+#include "fvc_queue.h"
+#include "fvc_log.h"
 
 #include "STM32_SPI_Bootloader/stm32_spi_bootloader.h"
 #include "W25Q_Driver/Library/w25q_mem.h"
@@ -40,7 +47,25 @@ enum current_working_mode
 
 #define CLI_BUFFOR_LEN			256
 #define DATA_OVERHEAD			7	// sfd, packet len, src_ID, dst_ID, packet type,, crc
-#define MAX_PROGRAM_DATA_LEN	(2*1024) // data
+#define MAX_PROGRAM_DATA_LEN	(4*1024) // data, advertised in TYPE_ID_RESP, host may use smaller frames
+#define FRAME_WINDOW_SIZE		1	// program frames host may send before waiting for ACK
+#define MAX_PROGRAM_FRAME_LEN	FEC_ENCODED_LEN(MAX_PROGRAM_DATA_LEN)	// data with FEC parity
+
+// frame length control: halved on every error, doubled after streak of good frames
+#define LINK_MIN_FRAME_LEN		256
+#define LINK_GROW_STREAK		8
+
+#define BAUD_IDLE_REVERT_MS		30000	// link falls back to default rate when host is silent
+#define TX_FLUSH_TIMEOUT_MS		2000	// full TX queue at lowest supported rate
+
+#define CONFIG_DEBUG_MASK		0x03		// protocol and interface debug output (see fvc_protocol.c)
+#define CONFIG_DEFERRED_LOG		(1 << 2)	// FVC_LOG records are sent as TYPE_LOG_DATA, host formats them
+
+#define UPDATE_HEADER_LEN		40	// firmware version, packet count, HMAC-SHA256
+#define UPDATE_HEADER_EXT_LEN	45	// + update flags, base image hash
+#define UPDATE_HEADER_GROUP_LEN	46	// + multicast group ID
+#define UPDATE_HEADER_PACKET_LEN	48	// + multicast packet length
+#define UPDATE_HEADER_PAYLOAD_LEN	52	// + total payload length, frames may vary in size
 //#define MAX_PROGRAM_DATA_LEN	256 // data
 
 #if !CFG_IGNORE_PROGRAM_HASH
@@ -62,8 +87,12 @@ struct fvc_ctx
 
 	// values change during program execution
 	enum board_status status;
-	bool interface_cli_data_present;
-	uint8_t interface_cli_data[CLI_BUFFOR_LEN];
+
+	// response to TYPE_PROGRAM_MULTICAST_STATUS after multicast session ended
+	enum payload_type multicast_result;
+
+	uint32_t default_baudrate;
+	uint32_t last_frame_tick;
 };
 
 static struct fvc_ctx ctx = {
@@ -72,8 +101,37 @@ static struct fvc_ctx ctx = {
 		.config = 0x00000000,
 
 		.curr_mode = MODE_UPDATER,
+		.multicast_result = TYPE_NACK,
+};
+
+struct update_header
+{
+	uint32_t firmware_id;
+	uint32_t packet_count;
+	uint8_t hmac_sha256[32];
+	uint8_t flags;
+	uint32_t base_hash;
+	uint8_t group_id;
+	uint16_t packet_len;
+	uint32_t payload_len;
+};
+
+struct link_stats
+{
+	uint32_t frames;
+	uint32_t crc_errors;
+	uint32_t timeouts;
+	uint32_t nacks;
+	uint16_t frame_len;		// frame length recommended to host
+	uint16_t good_streak;
+
+	struct fvc_fec_stats fec;
+	uint64_t fec_cycles;
 };
 
+static struct link_stats link;
+static uint8_t update_flags;
+
 // ------------------------------------------------
 // private functions
 
@@ -87,17 +145,60 @@ static void _reset_board(void);
 
 // command handlers
 static void _handle_update_program_request(struct protocol_frame *frame);
+static void _handle_baud_switch_request(struct protocol_frame *frame);
+static void _handle_id_request(void);
+static void _send_link_status(void);
+static void _handle_scrub_request(struct protocol_frame *frame);
+static void _handle_supervision_stats_request(struct protocol_frame *frame);
+
+// events passed from ISRs to tasks
+struct interface_rx_frame
+{
+	uint16_t len;
+	uint8_t data[CLI_BUFFOR_LEN];
+};
+
+enum timer_event
+{
+	TIMER_EVENT_SUPERVISION_EXPIRED = 0,
+};
 
+FVC_QUEUE_DEFINE(interface_rx_queue, struct interface_rx_frame, 4);
+FVC_QUEUE_DEFINE(interface_tx_queue, uint8_t, 8);		// responses requested by ISR, enum payload_type
+FVC_QUEUE_DEFINE(timer_event_queue, uint8_t, 4);		// enum timer_event
+
+// tasks of fvc_main loop
+static void _supervisor_task(void);
+static void _eeprom_task(void);
+static void _handle_invalid_program(void);
+static void _handle_baudrate_timeout(void);
+static void _handle_scrubber(void);
+
+static struct fvc_sched_task supervisor_task = {.name = "supervisor", .run = _supervisor_task, .priority = 0, .period_ms = 10, .budget_us = 200};
+static struct fvc_sched_task protocol_task = {.name = "protocol", .run = _process_msg, .priority = 1, .period_ms = 0, .budget_us = 5000};
+static struct fvc_sched_task program_task = {.name = "program", .run = _handle_invalid_program, .priority = 2, .period_ms = 100, .budget_us = 100};
+static struct fvc_sched_task link_task = {.name = "link", .run = _handle_baudrate_timeout, .priority = 3, .period_ms = 100, .budget_us = 100};
+static struct fvc_sched_task scrubber_task = {.name = "scrubber", .run = _handle_scrubber, .priority = 4, .period_ms = 10, .budget_us = 2000};
+static struct fvc_sched_task eeprom_task = {.name = "eeprom", .run = _eeprom_task, .priority = 5, .period_ms = 1000, .budget_us = 50000};
+static struct fvc_sched_task log_task = {.name = "log", .run = fvc_log_flush, .priority = 6, .period_ms = 100, .budget_us = 1000};
+
+// runs in UART interrupt, len 0 only rearms reception (called from thread)
 static void _interface_callback_handler(size_t len)
 {
 	static uint8_t data_buffor[CLI_BUFFOR_LEN];
 
-	if ((len > 0) && !ctx.interface_cli_data_present) {
-		memcpy(ctx.interface_cli_data, data_buffor, CLI_BUFFOR_LEN);
-		ctx.interface_cli_data_present = true;
-	} else if ((len > 0) && ctx.interface_cli_data_present)
-	{
-		send_response(false);
+	if (len > 0) {
+		struct interface_rx_frame *rx = fvc_queue_reserve(&interface_rx_queue);
+
+		if (rx != NULL) {
+			rx->len = (len > CLI_BUFFOR_LEN) ? CLI_BUFFOR_LEN : (uint16_t) len;
+			memcpy(rx->data, data_buffor, rx->len);
+			fvc_queue_commit(&interface_rx_queue);
+		} else {
+			uint8_t response = TYPE_NACK;
+			fvc_queue_push(&interface_tx_queue, &response);
+		}
+		fvc_sched_post(&protocol_task);
 	}
 
 	bsp_interface_receive_IT((uint8_t *)data_buffor, CLI_BUFFOR_LEN);
@@ -105,7 +206,16 @@ static void _interface_callback_handler(size_t len)
 
 static void _timer_elapsed_callback_handler()
 {
-	supervisor_timer_period_elapsed_callback(&ctx.sup);
+	uint8_t event = TIMER_EVENT_SUPERVISION_EXPIRED;
+
+	fvc_queue_push(&timer_event_queue, &event);
+	fvc_sched_post(&supervisor_task);
+}
+
+static void _spi_callback_handler(bool ok)
+{
+	supervisor_transfer_complete_callback(&ctx.sup, ok);
+	fvc_sched_post(&supervisor_task);
 }
 
 static void _execute_frame_response(struct protocol_frame *frame)
@@ -114,12 +224,29 @@ static void _execute_frame_response(struct protocol_frame *frame)
 
 	switch (frame->data_type) {
 		case TYPE_ID_REQ:
+			_handle_id_request();
+			break;
 		case TYPE_ID_RESP:
 		case TYPE_CLI_DATA:
 			break;
 		case TYPE_PROGRAM_UPDATE_REQUEST:
 			_handle_update_program_request(frame);
 			break;
+		case TYPE_PROGRAM_MULTICAST_STATUS:
+			send_response(ctx.multicast_result);
+			break;
+		case TYPE_BAUD_SWITCH_REQUEST:
+			_handle_baud_switch_request(frame);
+			break;
+		case TYPE_LINK_STATUS:
+			_send_link_status();
+			break;
+		case TYPE_SCRUB_REQUEST:
+			_handle_scrub_request(frame);
+			break;
+		case TYPE_SUPERVISION_STATS_REQUEST:
+			_handle_supervision_stats_request(frame);
+			break;
 		case TYPE_PROGRAM_DATA:
 		case TYPE_EEPROM_DATA_READ:
 		case TYPE_EEPROM_DATA_WRITE:
@@ -152,7 +279,244 @@ static void _get_board_info(void)
 		ctx.config = temp;
 	}
 
-	fvc_protocol_init(ctx.board_id, ((uint8_t) ctx.config) & 0x03);
+	fvc_protocol_init(ctx.board_id, ((uint8_t) ctx.config) & CONFIG_DEBUG_MASK);
+	fvc_log_init(((uint8_t) ctx.config) & CONFIG_DEBUG_MASK, (ctx.config & CONFIG_DEFERRED_LOG) != 0);
+	flush_transmit(TX_FLUSH_TIMEOUT_MS);
+	bsp_interface_set_address(ctx.board_id);
+}
+
+// target flash generation changes whenever FVC starts to modify target flash,
+// verified image marker holds only for generation it was recorded in
+static void _invalidate_verified_marker(void)
+{
+	uint32_t generation = 0;
+
+	fvc_eeprom_read(EEPROM_FLASH_GENERATION, &generation);
+	fvc_eeprom_write(EEPROM_FLASH_GENERATION, generation + 1);
+}
+
+static void _record_verified_marker(uint32_t program_hash)
+{
+	uint32_t generation = 0;
+
+	fvc_eeprom_read(EEPROM_FLASH_GENERATION, &generation);
+	fvc_eeprom_write(EEPROM_VERIFIED_HASH, program_hash);
+	fvc_eeprom_write(EEPROM_VERIFIED_GENERATION, generation);
+}
+
+#if CFG_FAST_BOOT
+#define FAST_BOOT_SAMPLES		8	// 256 B chunks compared with backup, first and last one always included
+
+static bool _is_verified_marker_valid(uint32_t program_len, uint32_t program_hash)
+{
+	uint32_t generation, verified_generation, verified_hash, backup_len, backup_hash;
+
+	// backup is reference for spot check, it has to describe current program
+	return fvc_eeprom_read(EEPROM_FLASH_GENERATION, &generation)
+			&& fvc_eeprom_read(EEPROM_VERIFIED_GENERATION, &verified_generation)
+			&& fvc_eeprom_read(EEPROM_VERIFIED_HASH, &verified_hash)
+			&& get_backup_info(&backup_len, &backup_hash)
+			&& (generation == verified_generation) && (verified_hash == program_hash)
+			&& (backup_len == program_len) && (backup_hash == program_hash);
+}
+
+// advances with every reset and is random after power-up, no EEPROM write per boot
+static uint32_t spot_check_rotation __attribute__((section(".noinit")));
+
+static bool _spot_check_target(uint32_t program_len)
+{
+	uint8_t prog_data[256], backup_data[256];
+	uint32_t chunks = (program_len + 255) / 256;
+	uint32_t backup_addr = get_backup_addr();
+	uint32_t rotation = spot_check_rotation++;
+
+	if (chunks == 0)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < FAST_BOOT_SAMPLES; i++)
+	{
+		// vector table and image end, remaining samples move with every boot to cover whole image over time
+		uint32_t chunk = (i == 0) ? 0 : (i == 1) ? (chunks - 1)
+				: ((rotation + (i - 2) * (chunks / (FAST_BOOT_SAMPLES - 2))) % chunks);
+		uint32_t addr = chunk * 256;
+		uint32_t len = ((program_len - addr) > 256) ? 256 : (program_len - addr);
+
+		if (!read_prog_memory(addr + APP_ADDR, prog_data, 256)
+				|| (W25Q_ReadRaw(backup_data, 256, backup_addr + addr) != W25Q_OK)
+				|| (memcmp(prog_data, backup_data, len) != 0))
+		{
+			return false;
+		}
+		HAL_Delay(5);
+	}
+
+	return true;
+}
+
+#endif
+
+// ------------------------------------------------
+// scrubber, verifies stored images in small steps between other main loop work
+
+#define SCRUB_STEP_INTERVAL_MS	10
+#define SCRUB_BACKUP_CHUNKS		4			// 256 B chunks per step
+#define SCRUB_TARGET_CHUNKS		1			// bootloader reads are slower than W25Q
+#define SCRUB_BACKUP_PERIOD_MS	(60*60*1000)
+
+static struct fvc_scrub scrub;
+static uint32_t scrub_last_step_tick;
+static uint32_t scrub_next_pass_tick;
+static bool scrub_target_requested;
+
+static bool _scrub_read_backup(uint32_t addr, uint8_t *data, size_t data_len)
+{
+	return W25Q_ReadRaw(data, data_len, addr) == W25Q_OK;
+}
+
+static bool _scrub_read_target(uint32_t addr, uint8_t *data, size_t data_len)
+{
+	if (read_prog_memory(addr, data, data_len))
+	{
+		return true;
+	}
+
+	bootloader_session_recover();
+	return read_prog_memory(addr, data, data_len);
+}
+
+static void _start_backup_scrub(void)
+{
+	uint32_t len, hash;
+
+	if (get_backup_info(&len, &hash) && (len > 0) && (len <= BACKUP_SLOT_SIZE))
+	{
+		fvc_scrub_start(&scrub, SCRUB_REGION_BACKUP, _scrub_read_backup, get_backup_addr(), len, hash);
+	}
+}
+
+// application is stopped in bootloader for the whole pass
+static void _start_target_scrub(void)
+{
+	uint32_t len, hash;
+
+	if ((ctx.status != STATUS_OK) || !fvc_eeprom_read(EEPROM_PROGRAM_LEN, &len) || !fvc_eeprom_read(EEPROM_PROGRAM_HASH, &hash))
+	{
+		return;
+	}
+
+	LOG_INFO(LOG_MODULE_BACKUP, "Maintenance window, verifying target\n\r");
+	ctx.curr_mode = MODE_UPDATER;
+	bsp_timer_stop();
+	bsp_updater_init();
+
+	if (!bootloader_session_open())
+	{
+		LOG_ERROR(LOG_MODULE_BOOTLOADER, "ERROR: Bootloader connection failed\n\r");
+		bsp_reset_gpio_controll(GPIO_RESET);
+		ctx.status = STATUS_BOOTLOADER_ERROR;
+		fvc_scrub_record(SCRUB_REGION_TARGET, SCRUB_RESULT_READ_ERROR);
+		return;
+	}
+
+	fvc_scrub_start(&scrub, SCRUB_REGION_TARGET, _scrub_read_target, APP_ADDR, len, hash);
+}
+
+static void _finish_target_scrub(enum scrub_result result)
+{
+	if (result == SCRUB_RESULT_OK)
+	{
+		_record_verified_marker(scrub.expected_hash);
+	}
+	else if (result == SCRUB_RESULT_MISMATCH)
+	{
+		// restored from backup by _handle_invalid_program
+		ctx.status = STATUS_PROGRAM_INVALID;
+		return;
+	}
+
+	if (!jmp_to_app(APP_ADDR))
+	{
+		ctx.status = STATUS_EXECUTION_ERROR;
+		return;
+	}
+
+	ctx.curr_mode = MODE_SUPERVISOR;
+	supervisor_init(&ctx.sup, &bsp_spi_transmit_IT, &bsp_spi_receive_IT, &bsp_spi_abort, &bsp_timer_start_refresh, &bsp_timer_get_elapsed_us, &_reset_board);
+}
+
+static void _handle_scrubber(void)
+{
+	uint32_t now = HAL_GetTick();
+
+	if ((now - scrub_last_step_tick) < SCRUB_STEP_INTERVAL_MS)
+	{
+		return;
+	}
+	scrub_last_step_tick = now;
+
+	if (!scrub.active)
+	{
+		if (scrub_target_requested)
+		{
+			scrub_target_requested = false;
+			_start_target_scrub();
+		}
+		else if ((int32_t) (now - scrub_next_pass_tick) >= 0)
+		{
+			scrub_next_pass_tick = now + SCRUB_BACKUP_PERIOD_MS;
+			_start_backup_scrub();
+		}
+		return;
+	}
+
+	// update moved backup to other slot, it is verified in next pass
+	if ((scrub.region == SCRUB_REGION_BACKUP) && (scrub.addr != get_backup_addr()))
+	{
+		scrub.active = false;
+		return;
+	}
+
+	enum scrub_result result = fvc_scrub_step(&scrub, (scrub.region == SCRUB_REGION_BACKUP) ? SCRUB_BACKUP_CHUNKS : SCRUB_TARGET_CHUNKS);
+	if (result == SCRUB_RESULT_NONE)
+	{
+		return;
+	}
+
+	fvc_scrub_record(scrub.region, result);
+	if (scrub.region == SCRUB_REGION_BACKUP)
+	{
+		LOG_INFO(LOG_MODULE_BACKUP, "Scrub of backup finished: %d\n\r", result);
+	}
+	else
+	{
+		LOG_INFO(LOG_MODULE_BACKUP, "Scrub of target finished: %d\n\r", result);
+	}
+
+	if (scrub.region == SCRUB_REGION_TARGET)
+	{
+		_finish_target_scrub(result);
+	}
+	else if (result != SCRUB_RESULT_OK)
+	{
+		// fast boot must not compare target against damaged backup
+		LOG_WARN(LOG_MODULE_BACKUP, "WARNING: Backup does not match program, next boot runs full verification\n\r");
+		_invalidate_verified_marker();
+	}
+}
+
+static void _handle_scrub_request(struct protocol_frame *frame)
+{
+	uint8_t payload[SCRUB_STATUS_LEN];
+
+	if ((frame->payload_len >= 1) && (frame->payload_ptr[0] & SCRUB_FLAG_TARGET))
+	{
+		scrub_target_requested = true;
+	}
+
+	fvc_scrub_get_status(payload);
+	send_frame(TYPE_SCRUB_STATUS, payload, sizeof(payload));
 }
 
 static bool _is_app_present_and_valid(void)
@@ -164,11 +528,25 @@ static bool _is_app_present_and_valid(void)
 		return false;
 	}
 
+#if CFG_FAST_BOOT
+	if (_is_verified_marker_valid(program_len, program_hash))
+	{
+		if (_spot_check_target(program_len))
+		{
+			// backup the check relied on is verified by scrubber right after boot
+			LOG_INFO(LOG_MODULE_BACKUP, "Fast boot, spot check passed\n\r");
+			return true;
+		}
+		bootloader_session_recover();
+	}
+#endif
+
 #if CFG_CREATE_BACKUP_AT_START && !CFG_BUFFORING_MODE
 	bool backup_should_be_valid = validate_current_backup(true);
+	uint32_t backup_addr = get_spare_backup_addr();
 	if (!backup_should_be_valid)
 	{
-		W25Q_EraseChip();
+		erase_spare_backup();
 	}
 #endif
 
@@ -192,146 +570,963 @@ static bool _is_app_present_and_valid(void)
 #if CFG_CREATE_BACKUP_AT_START && !CFG_BUFFORING_MODE
 			if (!backup_should_be_valid)
 			{
-				W25Q_ProgramRaw(prog_data, 256, current_addr);
+				W25Q_ProgramRaw(prog_data, 256, backup_addr + current_addr);
 			}
 #endif
 
 			calc_hash = fvc_calc_crc(calc_hash, prog_data, read_len);
 			current_addr += read_len;
 		} else {
-			jmp_to_bootloader();
+			bootloader_session_recover();
 		}
 		HAL_Delay(5);
 	}
 
+	if (calc_hash == program_hash)
+	{
+		_record_verified_marker(program_hash);
+	}
+
 #if CFG_CREATE_BACKUP_AT_START && !CFG_BUFFORING_MODE
 	if (!backup_should_be_valid)
 	{
 		if (calc_hash == program_hash)
 		{
-			fvc_eeprom_write(EEPROM_BACKUP_PROGRAM_LEN, program_len);
-			fvc_eeprom_write(EEPROM_BACKUP_PROGRAM_HASH, program_hash);
+			commit_spare_backup(program_len, program_hash);
 			return true;
 		}
 		return false;
 	}
 	else
 	{
-		return calc_hash == program_hash;
+		return calc_hash == program_hash;
+	}
+#else
+	return calc_hash == program_hash;
+#endif
+}
+
+static void _encode_u32(uint8_t *data, uint32_t value)
+{
+	data[0] = (uint8_t) (value >> 24);
+	data[1] = (uint8_t) (value >> 16);
+	data[2] = (uint8_t) (value >> 8);
+	data[3] = (uint8_t) value;
+}
+
+static void _link_stats_reset(void)
+{
+	memset(&link, 0, sizeof(link));
+	link.frame_len = MAX_PROGRAM_DATA_LEN;
+}
+
+static void _link_stats_update(bool frame_ok)
+{
+	if (frame_ok)
+	{
+		link.frames++;
+		if ((++link.good_streak >= LINK_GROW_STREAK) && (link.frame_len < MAX_PROGRAM_DATA_LEN))
+		{
+			link.frame_len *= 2;
+			link.good_streak = 0;
+		}
+	}
+	else
+	{
+		link.nacks++;
+		link.good_streak = 0;
+		if (link.frame_len > LINK_MIN_FRAME_LEN)
+		{
+			link.frame_len /= 2;
+		}
+	}
+}
+
+// ACK/NACK of program frame carries frame length host should use next
+static void _send_program_response(enum payload_type response)
+{
+	uint8_t payload[2] = {(uint8_t) (link.frame_len >> 8), (uint8_t) link.frame_len};
+
+	// scheduler does not run during update, records go out while host waits for response
+	fvc_log_flush();
+	send_frame(response, payload, sizeof(payload));
+}
+
+static void _send_link_status(void)
+{
+	uint8_t payload[LINK_STATUS_LEN];
+
+	_encode_u32(&payload[0], link.frames);
+	_encode_u32(&payload[4], link.crc_errors);
+	_encode_u32(&payload[8], link.timeouts);
+	_encode_u32(&payload[12], link.nacks);
+	payload[16] = (uint8_t) (link.frame_len >> 8);
+	payload[17] = (uint8_t) link.frame_len;
+	_encode_u32(&payload[18], link.fec.corrected);
+	_encode_u32(&payload[22], link.fec.failed);
+	_encode_u32(&payload[26], link.fec.blocks ? (uint32_t) (link.fec_cycles / link.fec.blocks) : 0);
+
+	send_frame(TYPE_LINK_STATUS, payload, sizeof(payload));
+}
+
+static void _handle_supervision_stats_request(struct protocol_frame *frame)
+{
+	uint8_t payload[SUPERVISION_STATS_HEADER_LEN + 4 * SUPERVISION_HISTOGRAM_BUCKETS + 2 + 4 * SUPERVISION_STATS_PAGE_VARS];
+	supervision_stats_t *stats = &ctx.sup.stats;
+	uint8_t first_var = (frame->payload_len >= 1) ? frame->payload_ptr[0] : 0;
+	uint8_t flags = (frame->payload_len >= 2) ? frame->payload_ptr[1] : 0;
+	uint8_t var_cnt = 0;
+	size_t pos = SUPERVISION_STATS_HEADER_LEN;
+
+	payload[0] = (uint8_t) ctx.sup.state;
+	payload[1] = ctx.sup.var_nb;
+	_encode_u32(&payload[2], stats->refreshes);
+	_encode_u32(&payload[6], stats->early_refreshes);
+	_encode_u32(&payload[10], stats->crc_errors);
+	_encode_u32(&payload[14], stats->resets);
+	_encode_u32(&payload[18], stats->interval_min_us);
+	_encode_u32(&payload[22], stats->interval_max_us);
+	_encode_u32(&payload[26], stats->refreshes ? (uint32_t) (stats->interval_sum_us / stats->refreshes) : 0);
+	_encode_u32(&payload[30], ctx.sup.last_refresh_interval_us);
+
+	for (size_t i = 0; i < SUPERVISION_HISTOGRAM_BUCKETS; i++, pos += 4)
+	{
+		_encode_u32(&payload[pos], stats->interval_histogram[i]);
+	}
+
+	if (first_var < ctx.sup.var_nb)
+	{
+		var_cnt = ctx.sup.var_nb - first_var;
+		if (var_cnt > SUPERVISION_STATS_PAGE_VARS)
+		{
+			var_cnt = SUPERVISION_STATS_PAGE_VARS;
+		}
+	}
+
+	payload[pos++] = first_var;
+	payload[pos++] = var_cnt;
+	for (size_t i = 0; i < var_cnt; i++, pos += 4)
+	{
+		_encode_u32(&payload[pos], stats->out_of_range[first_var + i]);
+	}
+
+	send_frame(TYPE_SUPERVISION_STATS, payload, pos);
+
+	if (flags & SUPERVISION_STATS_FLAG_CLEAR)
+	{
+		supervisor_clear_stats(&ctx.sup);
+	}
+}
+
+// corrects payload of serialized frame in place, frame CRC is checked afterwards
+static bool _correct_program_frame(uint8_t *data, size_t data_len)
+{
+	size_t frame_len = (((size_t) data[1]) << 8) | data[2];
+
+	// length field is not protected by FEC
+	if ((frame_len <= DATA_OVERHEAD) || (frame_len > data_len))
+	{
+		return false;
+	}
+
+	uint32_t start = bsp_get_cycles();
+	bool status = fvc_fec_decode(&data[DATA_OVERHEAD - 1], frame_len - DATA_OVERHEAD, &link.fec);
+	link.fec_cycles += bsp_get_cycles() - start;
+
+	return status;
+}
+
+static size_t _receive_and_deserialize_program_frame(uint8_t * data_out)
+{
+	uint8_t data[MAX_PROGRAM_FRAME_LEN + DATA_OVERHEAD] = {0};
+
+	struct protocol_frame packet;
+	packet.payload_ptr = data_out;
+
+	if (!bsp_interface_receive(data, sizeof(data))) {
+		link.timeouts++;
+	} else if ((update_flags & UPDATE_FLAG_FEC) && !_correct_program_frame(data, sizeof(data))) {
+		link.crc_errors++;
+	} else if (!frame_deserialize(&packet, data, sizeof(data))) {
+		link.crc_errors++;
+	} else if ((packet.destination_id == ctx.board_id) && (packet.data_type == TYPE_PROGRAM_DATA)) {
+		if (update_flags & UPDATE_FLAG_FEC) {
+			packet.payload_len = fvc_fec_strip(data_out, packet.payload_len);
+		}
+
+		if (packet.payload_len) {
+			_link_stats_update(true);
+			return packet.payload_len;
+		}
+	}
+
+	_link_stats_update(false);
+	return 0;
+}
+
+static bool _compare_data(uint8_t *data1, uint8_t *data2, size_t data_len)
+{
+	size_t iterator =  0;
+	while (iterator < data_len)
+	{
+		if (data1[iterator] != data2[iterator]) {
+			return false;
+		}
+		iterator++;
+	}
+	return true;
+}
+
+static bool _write_flash_range_to_memory(uint32_t data_addr, uint32_t end_addr)
+{
+	// ping-pong buffers, W25Q fills one while the other is programmed over SPI2
+	uint8_t buff[2][256] = {0};
+	uint8_t active_buff = 0;
+	bool active_buff_valid = false;
+	uint8_t retry_counter = 0;
+	uint32_t backup_addr = get_backup_addr();
+
+	while (data_addr < end_addr)
+	{
+		uint32_t next_addr = data_addr + 256;
+		bool next_buff_valid = false;
+
+		if (!active_buff_valid)
+		{
+			active_buff_valid = (W25Q_ReadRaw(buff[active_buff], 256, backup_addr + data_addr) == W25Q_OK);
+		}
+
+		LOG_TRACE(LOG_MODULE_BACKUP, "Copy block %X\n\r", data_addr);
+
+		if (active_buff_valid && write_memory_start(data_addr + APP_ADDR, buff[active_buff], 256))
+		{
+			// fetch next block while current one is transferred by DMA
+			if (next_addr < end_addr)
+			{
+				next_buff_valid = (W25Q_ReadRaw(buff[active_buff ^ 1], 256, backup_addr + next_addr) == W25Q_OK);
+			}
+
+			if (write_memory_finish())
+			{
+				retry_counter = 0;
+				data_addr = next_addr;
+				active_buff ^= 1;
+				active_buff_valid = next_buff_valid;
+				continue;
+			}
+		}
+
+		// failed block is resent from its buffer, bootloader is re-entered only if the link is lost
+		bootloader_session_recover();
+
+		retry_counter++;
+		LOG_TRACE(LOG_MODULE_BOOTLOADER, "Block %X retry %d\n\r", data_addr, retry_counter);
+		if (retry_counter > 3)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool _copy_program_from_flash_to_memory(void)
+{
+	uint32_t flash_prog_len, flash_prog_hash;
+
+	if(!get_backup_info(&flash_prog_len, &flash_prog_hash))
+	{
+		ctx.status = STATUS_PROGRAM_INVALID;
+		return false;
+	}
+
+	if(!bootloader_session_open())
+	{
+		ctx.status = STATUS_BOOTLOADER_ERROR;
+		return false;
+	}
+
+	_invalidate_verified_marker();
+	if (!erase_memory(0xFFFF, 0)) {
+		ctx.status = STATUS_BOOTLOADER_ERROR;
+		return false;
+	}
+
+	if (!_write_flash_range_to_memory(0, flash_prog_len))
+	{
+		ctx.status = STATUS_PROGRAM_INVALID;
+		return false;
+	}
+	return true;
+}
+
+#if CFG_BUFFORING_MODE && CFG_INCREMENTAL_FLASHING
+// pages erased in one bootloader command, page erase takes up to ~40 ms
+// so two pages fit into bootloader MAX_RESPONSE_TIMEOUT (100 ms) with margin
+#define ERASE_PAGES_PER_COMMAND		2
+
+#define PAGES_IN_LEN(_len)			(((_len) + TARGET_FLASH_PAGE_SIZE - 1) / TARGET_FLASH_PAGE_SIZE)
+
+struct target_pages
+{
+	bool valid;
+	uint32_t pages_nb;
+	uint32_t digest[TARGET_FLASH_PAGE_NB];
+};
+
+static struct target_pages target_pages;
+
+static void _collect_target_page_digests(void)
+{
+	uint32_t prog_len;
+
+	target_pages.valid = false;
+
+	// backup describes target content only if current program was validated and backup matches it
+	if ((ctx.status != STATUS_OK) || !fvc_eeprom_read(EEPROM_PROGRAM_LEN, &prog_len) || !validate_current_backup(true))
+	{
+		return;
+	}
+
+	target_pages.pages_nb = PAGES_IN_LEN(prog_len);
+	if (target_pages.pages_nb > TARGET_FLASH_PAGE_NB)
+	{
+		return;
+	}
+
+	for (uint32_t page = 0; page < target_pages.pages_nb; page++)
+	{
+		if (!calc_backup_page_digest(page * TARGET_FLASH_PAGE_SIZE, &target_pages.digest[page]))
+		{
+			return;
+		}
+	}
+
+	target_pages.valid = true;
+}
+
+static bool _write_pages_to_memory(uint16_t *pages, uint16_t pages_count, uint32_t new_pages_nb)
+{
+	if (!erase_memory_pages(pages, pages_count))
+	{
+		return false;
+	}
+
+	for (uint16_t i = 0; i < pages_count; i++)
+	{
+		// pages behind new image are only erased
+		if (pages[i] < new_pages_nb)
+		{
+			uint32_t page_addr = pages[i] * TARGET_FLASH_PAGE_SIZE;
+			if (!_write_flash_range_to_memory(page_addr, page_addr + TARGET_FLASH_PAGE_SIZE))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool _copy_changed_pages_from_flash_to_memory(void)
+{
+	uint32_t flash_prog_len, flash_prog_hash;
+	uint16_t pages[ERASE_PAGES_PER_COMMAND];
+	uint16_t pages_count = 0;
+	uint32_t changed_pages = 0;
+
+	if (!target_pages.valid || !get_backup_info(&flash_prog_len, &flash_prog_hash) || (PAGES_IN_LEN(flash_prog_len) > TARGET_FLASH_PAGE_NB))
+	{
+		return _copy_program_from_flash_to_memory();
+	}
+
+	target_pages.valid = false;
+
+	if(!bootloader_session_open())
+	{
+		ctx.status = STATUS_BOOTLOADER_ERROR;
+		return false;
+	}
+
+	_invalidate_verified_marker();
+
+	uint32_t new_pages_nb = PAGES_IN_LEN(flash_prog_len);
+	uint32_t last_page = (new_pages_nb > target_pages.pages_nb) ? new_pages_nb : target_pages.pages_nb;
+
+	for (uint32_t page = 0; page < last_page; page++)
+	{
+		uint32_t digest = 0;
+		bool changed = (page >= new_pages_nb) || (page >= target_pages.pages_nb);
+
+		if (!changed)
+		{
+			if (!calc_backup_page_digest(page * TARGET_FLASH_PAGE_SIZE, &digest))
+			{
+				return _copy_program_from_flash_to_memory();
+			}
+			changed = (digest != target_pages.digest[page]);
+		}
+
+		if (changed)
+		{
+			pages[pages_count++] = (uint16_t) page;
+			changed_pages++;
+		}
+
+		if ((pages_count == ERASE_PAGES_PER_COMMAND) || ((page + 1 == last_page) && (pages_count > 0)))
+		{
+			if (!_write_pages_to_memory(pages, pages_count, new_pages_nb))
+			{
+				ctx.status = STATUS_PROGRAM_INVALID;
+				return false;
+			}
+			pages_count = 0;
+		}
+	}
+
+	LOG_INFO(LOG_MODULE_CORE, "Incremental update: %d of %d pages programmed\n\r", changed_pages, last_page);
+	return true;
+}
+#endif
+
+static uint32_t _decode_u32(uint8_t *data)
+{
+	return ((((uint32_t) data[0]) << 24)
+			| (((uint32_t) data[1]) << 16)
+			| (((uint32_t) data[2]) << 8)
+			| ((uint32_t) data[3]));
+}
+
+// hosts sending variable frame lengths give total payload length instead of frame count
+static bool _is_payload_complete(struct update_header *header, size_t frame_counter, uint32_t received_len)
+{
+	if (header->payload_len)
+	{
+		return received_len >= header->payload_len;
+	}
+	return frame_counter >= header->packet_count;
+}
+
+static void _decode_header_data(struct protocol_frame *frame, struct update_header *header)
+{
+	uint8_t *frame_payload = frame->payload_ptr;
+
+	header->firmware_id = _decode_u32(&frame_payload[0]);
+	header->packet_count = _decode_u32(&frame_payload[4]);
+	memcpy(header->hmac_sha256, &frame_payload[8], 32);
+
+	// older hosts send only the basic header
+	header->flags = 0;
+	header->base_hash = 0;
+	header->group_id = 0;
+	header->packet_len = MAX_PROGRAM_DATA_LEN;
+	header->payload_len = 0;
+
+	if (frame->payload_len >= UPDATE_HEADER_EXT_LEN)
+	{
+		header->flags = frame_payload[40];
+		header->base_hash = _decode_u32(&frame_payload[41]);
+	}
+
+	if (frame->payload_len >= UPDATE_HEADER_GROUP_LEN)
+	{
+		header->group_id = frame_payload[45];
+	}
+
+	if (frame->payload_len >= UPDATE_HEADER_PACKET_LEN)
+	{
+		header->packet_len = (((uint16_t) frame_payload[46]) << 8) | ((uint16_t) frame_payload[47]);
+	}
+
+	if (frame->payload_len >= UPDATE_HEADER_PAYLOAD_LEN)
+	{
+		header->payload_len = _decode_u32(&frame_payload[48]);
+	}
+}
+
+#if CFG_BUFFORING_MODE
+struct image_writer
+{
+	uint32_t addr;
+	uint32_t len;
+	uint32_t hash;
+	size_t page_fill;
+	uint8_t page[256];
+};
+
+static struct image_writer writer;
+
+static struct fvc_delta delta;
+static struct fvc_lz lz;
+
+static void _image_writer_init(uint32_t addr)
+{
+	writer.addr = addr;
+	writer.len = 0;
+	writer.hash = 0xFFFFFFFF;
+	writer.page_fill = 0;
+}
+
+static bool _image_writer_program_page(void)
+{
+	uint8_t validation_data[256] = {0};
+
+	if (writer.page_fill < 256)
+	{
+		memset(&writer.page[writer.page_fill], ERASED_MEMORY_VALUE, 256 - writer.page_fill);
+	}
+
+	for (uint8_t retry_counter = 0; retry_counter <= 3; retry_counter++)
+	{
+		if ((W25Q_ProgramRaw(writer.page, 256, writer.addr) == W25Q_OK)
+				&& (W25Q_ReadRaw(validation_data, 256, writer.addr) == W25Q_OK)
+				&& _compare_data(writer.page, validation_data, 256))
+		{
+			writer.addr += 256;
+			writer.page_fill = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool _image_writer_write(uint8_t *data, size_t data_len)
+{
+	if (writer.len + data_len > BACKUP_SLOT_SIZE)
+	{
+		return false;
+	}
+
+	writer.len += data_len;
+	writer.hash = fvc_calc_crc(writer.hash, data, data_len);
+
+#if !CFG_IGNORE_PROGRAM_HASH
+	fvc_calc_hmac_sha256_write_data(data, data_len);
+#endif
+
+	while (data_len > 0)
+	{
+		size_t chunk_len = 256 - writer.page_fill;
+		if (chunk_len > data_len)
+		{
+			chunk_len = data_len;
+		}
+
+		memcpy(&writer.page[writer.page_fill], data, chunk_len);
+		writer.page_fill += chunk_len;
+		data += chunk_len;
+		data_len -= chunk_len;
+
+		if ((writer.page_fill == 256) && !_image_writer_program_page())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool _image_writer_flush(void)
+{
+	return (writer.page_fill == 0) || _image_writer_program_page();
+}
+
+// decompressed payload is either patch or plain image
+static bool _update_payload_write(uint8_t *data, size_t data_len)
+{
+	if (update_flags & UPDATE_FLAG_DELTA)
+	{
+		return fvc_delta_write(&delta, data, data_len);
+	}
+	return _image_writer_write(data, data_len);
+}
+
+static bool _update_stream_write(uint8_t *data, size_t data_len)
+{
+	if (update_flags & UPDATE_FLAG_COMPRESSED)
+	{
+		return fvc_lz_write(&lz, data, data_len);
+	}
+	return _update_payload_write(data, data_len);
+}
+
+static bool _update_stream_finish(void)
+{
+	if ((update_flags & UPDATE_FLAG_COMPRESSED) && !fvc_lz_finish(&lz))
+	{
+		return false;
+	}
+
+	if ((update_flags & UPDATE_FLAG_DELTA) && !fvc_delta_finish(&delta))
+	{
+		return false;
+	}
+
+	return _image_writer_flush();
+}
+
+#define RESUME_CHECKPOINT_LEN	(16*1024)	// payload committed between checkpoints
+#define RESUME_SHA_STATE_WORDS	8
+
+// stored word by word starting at EEPROM_RESUME_SESSION
+struct resume_checkpoint
+{
+	uint32_t session;
+	uint32_t offset;		// payload bytes stored in spare slot
+	uint32_t frames;
+	uint32_t crc;			// image CRC state
+	uint32_t sha_state[RESUME_SHA_STATE_WORDS];
+};
+
+// same image sent the same way gives the same session
+static uint32_t _resume_session_id(struct update_header *header)
+{
+	return _decode_u32(header->hmac_sha256) ^ header->payload_len ^ header->packet_count;
+}
+
+// plain images only, decompressor and patch state is not kept
+static bool _is_resume_allowed(struct update_header *header)
+{
+	return (header->flags & UPDATE_FLAG_RESUME) && !(header->flags & (UPDATE_FLAG_DELTA | UPDATE_FLAG_COMPRESSED));
+}
+
+// EEPROM_RESUME_CHECK is written last, checkpoint interrupted while storing is discarded
+static bool _resume_save(uint32_t session, size_t frames, uint32_t offset)
+{
+	struct resume_checkpoint checkpoint = {.session = session, .offset = offset, .frames = frames, .crc = writer.hash};
+	uint32_t *words = (uint32_t *) &checkpoint;
+
+	if (writer.page_fill != 0)
+	{
+		return false;
+	}
+
+#if !CFG_IGNORE_PROGRAM_HASH
+	if (!fvc_calc_hmac_sha256_get_state(checkpoint.sha_state))
+	{
+		return false;
+	}
+#endif
+
+	for (size_t i = 0; i < (sizeof(checkpoint) / sizeof(uint32_t)); i++)
+	{
+		if (!fvc_eeprom_write(EEPROM_RESUME_SESSION + i, words[i]))
+		{
+			return false;
+		}
+	}
+
+	return fvc_eeprom_write(EEPROM_RESUME_CHECK, fvc_calc_crc(0xFFFFFFFF, (uint8_t *) &checkpoint, sizeof(checkpoint)));
+}
+
+static void _resume_clear(void)
+{
+	// any change of a single word breaks EEPROM_RESUME_CHECK
+	fvc_eeprom_write(EEPROM_RESUME_OFFSET, 0);
+}
+
+static bool _resume_restore(uint32_t session, size_t *frames, uint32_t *offset)
+{
+	struct resume_checkpoint checkpoint;
+	uint32_t *words = (uint32_t *) &checkpoint;
+	uint32_t check, crc = 0xFFFFFFFF;
+	uint8_t data[256];
+	uint32_t addr = get_spare_backup_addr();
+
+	for (size_t i = 0; i < (sizeof(checkpoint) / sizeof(uint32_t)); i++)
+	{
+		if (!fvc_eeprom_read(EEPROM_RESUME_SESSION + i, &words[i]))
+		{
+			return false;
+		}
+	}
+
+	if (!fvc_eeprom_read(EEPROM_RESUME_CHECK, &check)
+			|| (check != fvc_calc_crc(0xFFFFFFFF, (uint8_t *) &checkpoint, sizeof(checkpoint)))
+			|| (checkpoint.session != session) || (checkpoint.offset == 0) || (checkpoint.offset > BACKUP_SLOT_SIZE))
+	{
+		return false;
+	}
+
+	// spare slot has to still hold data the checkpoint describes
+	for (uint32_t pos = 0; pos < checkpoint.offset; pos += sizeof(data))
+	{
+		if (W25Q_ReadRaw(data, sizeof(data), addr + pos) != W25Q_OK)
+		{
+			return false;
+		}
+		crc = fvc_calc_crc(crc, data, sizeof(data));
+	}
+
+	if (crc != checkpoint.crc)
+	{
+		LOG_ERROR(LOG_MODULE_BACKUP, "Checkpoint does not match backup slot!\n\r");
+		return false;
+	}
+
+	_image_writer_init(addr + checkpoint.offset);
+	writer.len = checkpoint.offset;
+	writer.hash = checkpoint.crc;
+
+#if !CFG_IGNORE_PROGRAM_HASH
+	fvc_calc_hmac_sha256_set_state(hmac_sha256_key, sizeof(hmac_sha256_key), checkpoint.sha_state, checkpoint.offset);
+#endif
+
+	*frames = checkpoint.frames;
+	*offset = checkpoint.offset;
+	return true;
+}
+
+// flashes target from new backup slot and starts it
+static bool _apply_buffered_update(uint32_t firmware_id, uint32_t prog_len, uint32_t prog_hash)
+{
+	ctx.curr_mode = MODE_UPDATER;
+	bsp_updater_init();
+
+#if CFG_INCREMENTAL_FLASHING
+	if (!_copy_changed_pages_from_flash_to_memory())
+#else
+	if (!_copy_program_from_flash_to_memory())
+#endif
+	{
+		LOG_ERROR(LOG_MODULE_BACKUP, "Failed to save new program!\n\r");
+		ctx.status = STATUS_PROGRAM_INVALID;
+
+		return false;
+	}
+
+	LOG_INFO(LOG_MODULE_CORE, "Update finished. Executing app.\n\r");
+	jmp_to_app(APP_ADDR);
+
+	fvc_eeprom_write(EEPROM_FIRMWARE_VERSION, firmware_id);
+	fvc_eeprom_write(EEPROM_PROGRAM_LEN, prog_len);
+	fvc_eeprom_write(EEPROM_PROGRAM_HASH, prog_hash);
+	ctx.status = STATUS_OK;
+
+	ctx.curr_mode = MODE_SUPERVISOR;
+	supervisor_init(&ctx.sup, &bsp_spi_transmit_IT, &bsp_spi_receive_IT, &bsp_spi_abort, &bsp_timer_start_refresh, &bsp_timer_get_elapsed_us, &_reset_board);
+	return true;
+}
+
+/*
+ * Multicast session: every joined board stores packets sent once to the group ID
+ * at fixed offsets of spare backup slot, so packets may arrive in any order.
+ * Host polls each board for bitmap of missing packets and resends their union
+ * to the group, then commits update to the whole group.
+ */
+#define MULTICAST_MIN_PACKET_LEN	1024
+#define MULTICAST_MAX_PACKETS		(BACKUP_SLOT_SIZE / MULTICAST_MIN_PACKET_LEN)
+#define MULTICAST_SEQ_LEN			2
+#define MULTICAST_IDLE_TIMEOUTS		20	// receive timeouts without any frame before session is dropped
+
+struct multicast_session
+{
+	uint8_t group_id;
+	uint16_t packet_count;
+	uint16_t packet_len;
+	uint16_t last_packet_len;
+	uint8_t missing[MULTICAST_MAX_PACKETS / 8];
+};
+
+static struct multicast_session multicast;
+
+static void _store_multicast_packet(struct protocol_frame *frame)
+{
+	uint8_t *payload = frame->payload_ptr;
+
+	if (frame->payload_len <= MULTICAST_SEQ_LEN)
+	{
+		return;
 	}
-#else
-	return calc_hash == program_hash;
-#endif
-}
 
-static size_t _receive_and_deserialize_program_frame(uint8_t * data_out)
-{
-	uint8_t data[MAX_PROGRAM_DATA_LEN + DATA_OVERHEAD] = {0};
+	uint16_t seq = (((uint16_t) payload[0]) << 8) | ((uint16_t) payload[1]);
+	size_t data_len = frame->payload_len - MULTICAST_SEQ_LEN;
+	uint8_t *data = &payload[MULTICAST_SEQ_LEN];
 
-	struct protocol_frame packet;
-	packet.payload_ptr = data_out;
+	// only last packet may be shorter, otherwise its offset would be ambiguous
+	if ((seq >= multicast.packet_count) || !(multicast.missing[seq / 8] & (1 << (seq % 8)))
+			|| (data_len > multicast.packet_len)
+			|| ((data_len != multicast.packet_len) && (seq != multicast.packet_count - 1)))
+	{
+		return;
+	}
 
-	if (bsp_interface_receive(data, sizeof(data))) {
-		if (frame_deserialize(&packet, data, sizeof(data))) {
-			if ((packet.destination_id == ctx.board_id) && (packet.data_type == TYPE_PROGRAM_DATA)) {
-				return packet.payload_len;
-			}
+	uint32_t addr = get_spare_backup_addr() + ((uint32_t) seq) * multicast.packet_len;
+	for (size_t offset = 0; offset < data_len; offset += 256)
+	{
+		uint16_t chunk_len = ((data_len - offset) > 256) ? 256 : (uint16_t) (data_len - offset);
+
+		// packet stays missing and will be resent in next round
+		if (W25Q_ProgramRaw(&data[offset], chunk_len, addr + offset) != W25Q_OK)
+		{
+			return;
 		}
 	}
-	return 0;
+
+	if (seq == multicast.packet_count - 1)
+	{
+		multicast.last_packet_len = data_len;
+	}
+	multicast.missing[seq / 8] &= ~(1 << (seq % 8));
 }
 
-static bool _compare_data(uint8_t *data1, uint8_t *data2, size_t data_len)
+static bool _is_multicast_complete(void)
 {
-	size_t iterator =  0;
-	while (iterator < data_len)
+	for (size_t i = 0; i < sizeof(multicast.missing); i++)
 	{
-		if (data1[iterator] != data2[iterator]) {
+		if (multicast.missing[i])
+		{
 			return false;
 		}
-		iterator++;
 	}
 	return true;
 }
 
-static bool _copy_program_from_flash_to_memory(void)
+static bool _finish_multicast_update(uint32_t firmware_id, uint8_t *hmac_sha256)
 {
-	uint8_t buff[256] = {0};
-	uint32_t flash_prog_len, flash_prog_hash;
-	uint32_t data_addr = 0;
-	uint8_t retry_counter = 0;
+	uint8_t data[256];
+	uint32_t addr = get_spare_backup_addr();
+	uint32_t prog_len = ((uint32_t) (multicast.packet_count - 1)) * multicast.packet_len + multicast.last_packet_len;
+	uint32_t prog_hash = 0xFFFFFFFF;
 
-	if(!fvc_eeprom_read(EEPROM_BACKUP_PROGRAM_LEN, &flash_prog_len) || !fvc_eeprom_read(EEPROM_BACKUP_PROGRAM_HASH, &flash_prog_hash))
+	if (!_is_multicast_complete())
 	{
-		ctx.status = STATUS_PROGRAM_INVALID;
+		LOG_WARN(LOG_MODULE_CORE, "Multicast commit with missing packets!\n\r");
 		return false;
 	}
 
-	if(!jmp_to_bootloader())
+#if !CFG_IGNORE_PROGRAM_HASH
+	uint8_t calc_program_hmac_sha256[32] = {0};
+	fvc_calc_hmac_sha256_init(hmac_sha256_key, sizeof(hmac_sha256_key));
+#endif
+
+	// packets were stored out of order, hashes are calculated over stored image
+	for (uint32_t offset = 0; offset < prog_len; offset += 256)
 	{
-		ctx.status = STATUS_BOOTLOADER_ERROR;
-		return false;
+		uint16_t chunk_len = ((prog_len - offset) > 256) ? 256 : (uint16_t) (prog_len - offset);
+
+		if (W25Q_ReadRaw(data, chunk_len, addr + offset) != W25Q_OK)
+		{
+			return false;
+		}
+
+		prog_hash = fvc_calc_crc(prog_hash, data, chunk_len);
+#if !CFG_IGNORE_PROGRAM_HASH
+		fvc_calc_hmac_sha256_write_data(data, chunk_len);
+#endif
 	}
 
-	if (!erase_memory(0xFFFF, 0)) {
-		ctx.status = STATUS_BOOTLOADER_ERROR;
+#if !CFG_IGNORE_PROGRAM_HASH
+	fvc_calc_hmac_sha256_end_calc(calc_program_hmac_sha256);
+	if (memcmp(calc_program_hmac_sha256, hmac_sha256, 32) != 0)
+	{
+		LOG_ERROR(LOG_MODULE_CORE, "Received program HMAC-SHA256 is incorrect!\n\r");
 		return false;
 	}
+#endif
 
-	while (data_addr < flash_prog_len)
+	if (!commit_spare_backup(prog_len, prog_hash))
 	{
-		if(W25Q_ReadRaw(buff, 256, data_addr) == W25Q_OK)
-		{
-			if(write_memory(data_addr + APP_ADDR, buff, 256))
-			{
-				retry_counter = 0;
-				data_addr += 256;
-			}
-			else
-			{
-				jmp_to_bootloader();
-				retry_counter++;
-				if (retry_counter > 3)
-				{
-					ctx.status = STATUS_PROGRAM_INVALID;
-					return false;
-				}
-				
-			}
-		}
+		return false;
 	}
-	return true;
+
+	return _apply_buffered_update(firmware_id, prog_len, prog_hash);
 }
 
-static void _decode_header_data(uint8_t *frame_payload ,uint32_t *new_firmware_id, uint32_t *packet_count, uint8_t *program_hmac_sha256)
+static void _handle_multicast_update_request(struct update_header *header)
 {
-	*new_firmware_id = ((((uint32_t) frame_payload[0]) << 24)
-			| (((uint32_t) frame_payload[1]) << 16)
-			| (((uint32_t) frame_payload[2]) << 8)
-			| ((uint32_t) frame_payload[3]));
+	uint8_t data[MAX_PROGRAM_DATA_LEN + MULTICAST_SEQ_LEN + DATA_OVERHEAD] = {0};
+	uint8_t payload[MAX_PROGRAM_DATA_LEN + MULTICAST_SEQ_LEN + DATA_OVERHEAD] = {0};
+	struct protocol_frame frame;
+	size_t idle_counter = 0;
+
+	frame.payload_ptr = payload;
+
+	// packets are stored at fixed offsets, so only plain images can be multicast,
+	// packet length must keep them aligned to W25Q pages
+	if ((header->flags & (UPDATE_FLAG_DELTA | UPDATE_FLAG_COMPRESSED | UPDATE_FLAG_FEC))
+			|| (header->group_id < PROTOCOL_GROUP_ID_MIN) || (header->group_id > PROTOCOL_GROUP_ID_MAX)
+			|| (header->packet_len < MULTICAST_MIN_PACKET_LEN) || (header->packet_len > MAX_PROGRAM_DATA_LEN)
+			|| ((header->packet_len % 256) != 0)
+			|| (header->packet_count == 0) || (header->packet_count > (BACKUP_SLOT_SIZE / header->packet_len)))
+	{
+		LOG_ERROR(LOG_MODULE_PROTOCOL, "Invalid multicast update request!\n\r");
+		send_response(TYPE_FATAL_ERROR);
+		return;
+	}
+
+	multicast.group_id = header->group_id;
+	multicast.packet_count = header->packet_count;
+	multicast.packet_len = header->packet_len;
+	multicast.last_packet_len = 0;
+	memset(multicast.missing, 0, sizeof(multicast.missing));
+	for (uint16_t seq = 0; seq < multicast.packet_count; seq++)
+	{
+		multicast.missing[seq / 8] |= (1 << (seq % 8));
+	}
+
+	ctx.multicast_result = TYPE_NACK;
+
+#if CFG_INCREMENTAL_FLASHING
+	_collect_target_page_digests();
+#endif
+
+	// joined before erase, packets lost meanwhile are recovered from status bitmap
+	send_response(TYPE_ACK);
+	LOG_INFO(LOG_MODULE_PROTOCOL, "Joined multicast group %d\n\r", multicast.group_id);
+
+	if (!erase_spare_backup())
+	{
+		LOG_ERROR(LOG_MODULE_W25Q, "Failed to erase backup slot!\n\r");
+		ctx.multicast_result = TYPE_FATAL_ERROR;
+		return;
+	}
+
+	// group frames and unicast status polls must both reach the board
+	bsp_interface_mute_control(false);
+
+	while (idle_counter < MULTICAST_IDLE_TIMEOUTS)
+	{
+		if (!bsp_interface_receive(data, sizeof(data)))
+		{
+			idle_counter++;
+			continue;
+		}
+
+		idle_counter = 0;
+		if (!frame_deserialize(&frame, data, sizeof(data)))
+		{
+			continue;
+		}
+
+		if ((frame.data_type == TYPE_PROGRAM_MULTICAST_DATA) && (frame.destination_id == multicast.group_id))
+		{
+			_store_multicast_packet(&frame);
+		}
+		else if ((frame.data_type == TYPE_PROGRAM_MULTICAST_STATUS) && (frame.destination_id == ctx.board_id))
+		{
+			send_frame(TYPE_PROGRAM_MULTICAST_STATUS, multicast.missing, (multicast.packet_count + 7) / 8);
+		}
+		else if ((frame.data_type == TYPE_PROGRAM_MULTICAST_COMMIT) && (frame.destination_id == multicast.group_id))
+		{
+			bsp_interface_mute_control(true);
+			ctx.multicast_result = _finish_multicast_update(header->firmware_id, header->hmac_sha256) ? TYPE_PROGRAM_UPDATE_FINISHED : TYPE_FATAL_ERROR;
+			return;
+		}
 
-	*packet_count = ((((uint32_t) frame_payload[4]) << 24)
-			| (((uint32_t) frame_payload[5]) << 16)
-			| (((uint32_t) frame_payload[6]) << 8)
-			| ((uint32_t) frame_payload[7]));
+		memset(data, 0, sizeof(data));
+	}
 
-	memcpy(program_hmac_sha256, &frame_payload[8], 32);
+	bsp_interface_mute_control(true);
+	LOG_WARN(LOG_MODULE_PROTOCOL, "Multicast session timed out\n\r");
+	ctx.multicast_result = TYPE_FATAL_ERROR;
 }
 
-#if CFG_BUFFORING_MODE
 static void _handle_update_program_request(struct protocol_frame *frame)
 {
 	ctx.curr_mode = MODE_UPDATER;
 
-	debug_transmit("Updating board\n\r");
+	LOG_INFO(LOG_MODULE_CORE, "Updating board\n\r");
 	bool update_status = false;
-	uint32_t memory_addr = 0;
-	uint8_t program_data[MAX_PROGRAM_DATA_LEN] = {0};
-	uint8_t validation_data[256] = {0};
-	uint32_t new_firmware_id, packet_count;
-	uint8_t program_hmac_sha256[32] = {0};
-	uint32_t prog_len = 0;
-	uint32_t prog_hash = 0xFFFFFFFF;
+	uint8_t program_data[MAX_PROGRAM_FRAME_LEN] = {0};
+	struct update_header header;
 
 	size_t retry_counter = 0;
 	size_t program_data_len = 0;
@@ -343,126 +1538,177 @@ static void _handle_update_program_request(struct protocol_frame *frame)
 	fvc_calc_hmac_sha256_init(hmac_sha256_key, sizeof(hmac_sha256_key));
 #endif
 
-	_decode_header_data(frame->payload_ptr, &new_firmware_id ,&packet_count, program_hmac_sha256);
+	_decode_header_data(frame, &header);
+	update_flags = header.flags;
+
+	if (header.flags & UPDATE_FLAG_MULTICAST)
+	{
+		_handle_multicast_update_request(&header);
+		return;
+	}
 
-	W25Q_EraseChip();
+	if (header.flags & UPDATE_FLAG_COMPRESSED)
+	{
+		fvc_lz_init(&lz, _update_payload_write);
+	}
 
-	send_response(TYPE_ACK);
+	if (header.flags & UPDATE_FLAG_DELTA)
+	{
+		uint32_t base_len, base_hash;
+
+		// patch can be applied only to the exact image it was generated against
+		if (!get_backup_info(&base_len, &base_hash)
+				|| (base_hash != header.base_hash) || !validate_current_backup(false))
+		{
+			LOG_ERROR(LOG_MODULE_BACKUP, "Delta base image does not match backup!\n\r");
+			send_response(TYPE_FATAL_ERROR);
+			return;
+		}
+
+		fvc_delta_init(&delta, get_backup_addr(), base_len, _image_writer_write);
+	}
+
+#if CFG_INCREMENTAL_FLASHING
+	_collect_target_page_digests();
+#endif
 
 	size_t counter = 0;
-	while(counter < packet_count)
+	uint32_t received_len = 0;
+	uint32_t checkpoint_len = 0;
+	uint32_t session = _resume_session_id(&header);
+	bool resume = _is_resume_allowed(&header);
+
+	if (resume && _resume_restore(session, &counter, &received_len))
+	{
+		LOG_INFO(LOG_MODULE_CORE, "Resuming update at %d bytes\n\r", received_len);
+		checkpoint_len = received_len;
+	}
+	else
+	{
+		_resume_clear();
+		if (!erase_spare_backup())
+		{
+			LOG_ERROR(LOG_MODULE_W25Q, "Failed to erase backup slot!\n\r");
+			send_response(TYPE_FATAL_ERROR);
+			return;
+		}
+
+		_image_writer_init(get_spare_backup_addr());
+	}
+
+	_link_stats_reset();
+
+	if (header.flags & UPDATE_FLAG_RESUME)
+	{
+		uint8_t payload[RESUME_ACK_LEN];
+
+		_encode_u32(&payload[0], received_len);
+		_encode_u32(&payload[4], counter);
+		send_frame(TYPE_ACK, payload, sizeof(payload));
+	}
+	else
+	{
+		send_response(TYPE_ACK);
+	}
+
+	while(!_is_payload_complete(&header, counter, received_len))
 	{
 		program_data_len = _receive_and_deserialize_program_frame(program_data);
 		if (program_data_len)
 		{
-			debug_transmit("Received packet %d\n\r", counter);
+			LOG_DEBUG(LOG_MODULE_PROTOCOL, "Received packet %d\n\r", counter);
 
-			prog_len += program_data_len;
-			prog_hash = fvc_calc_crc(prog_hash, program_data, program_data_len);
-
-#if !CFG_IGNORE_PROGRAM_HASH
-			fvc_calc_hmac_sha256_write_data(program_data, program_data_len);
-#endif
-			if ((program_data_len % 256) != 0)
+			if (!_update_stream_write(program_data, program_data_len))
 			{
-				memset(&program_data[program_data_len], 0xFF, MAX_PROGRAM_DATA_LEN - program_data_len);
+				LOG_ERROR(LOG_MODULE_W25Q, "Failed to store packet %d\n\r", counter);
+				goto finish;
 			}
 
-			size_t iterator = 0;
-			while(iterator < MAX_PROGRAM_DATA_LEN) {
+			counter++;
+			received_len += program_data_len;
+			retry_counter = 0;
 
-				if (W25Q_ProgramRaw(&program_data[iterator], 256, memory_addr) == W25Q_OK) {
-					W25Q_ReadRaw(validation_data, 256, memory_addr);
-					if (_compare_data(&program_data[iterator],validation_data,256))
-					{
-						memory_addr += 256;
-						iterator += 256;
-					}
-					else
-					{
-						retry_counter++;
-						if(retry_counter > 3)
-						{
-							send_response(TYPE_FATAL_ERROR);
-							goto finish;
-						}
-					}
-				}
+			if (resume && ((received_len - checkpoint_len) >= RESUME_CHECKPOINT_LEN) && _resume_save(session, counter, received_len))
+			{
+				checkpoint_len = received_len;
 			}
-			counter++;
-			send_response(TYPE_ACK);
+
+			_send_program_response(TYPE_ACK);
 		}
 		else
 		{
 			retry_counter++;
-			debug_transmit("Failed to receive packet %d\n\r", counter);
+			LOG_WARN(LOG_MODULE_PROTOCOL, "Failed to receive packet %d\n\r", counter);
 
 			if(retry_counter > 3)
 			{
-				send_response(TYPE_FATAL_ERROR);
 				goto finish;
 			}
 			else
 			{
-				send_response(TYPE_NACK);
+				_send_program_response(TYPE_NACK);
 			}
 		}
 	}
 
+	LOG_INFO(LOG_MODULE_PROTOCOL, "Link: %d frames, %d CRC errors, %d timeouts, frame length %d\n\r", link.frames, link.crc_errors, link.timeouts, link.frame_len);
+	// whole image was received, next request starts over
+	_resume_clear();
+
+	if (header.flags & UPDATE_FLAG_FEC)
+	{
+		LOG_INFO(LOG_MODULE_PROTOCOL, "FEC: %d codewords, %d bytes corrected, %d failed, %d cycles per codeword\n\r", link.fec.blocks, link.fec.corrected,
+				link.fec.failed, link.fec.blocks ? (uint32_t) (link.fec_cycles / link.fec.blocks) : 0);
+	}
+
+	if (!_update_stream_finish())
+	{
+		LOG_ERROR(LOG_MODULE_W25Q, "Failed to store program!\n\r");
+		send_response(TYPE_FATAL_ERROR);
+		return;
+	}
+
 #if !CFG_IGNORE_PROGRAM_HASH
 	fvc_calc_hmac_sha256_end_calc(calc_program_hmac_sha256);
-	if (memcmp(calc_program_hmac_sha256, program_hmac_sha256, 32) != 0) 
+	if (memcmp(calc_program_hmac_sha256, header.hmac_sha256, 32) != 0)
 	{
-		debug_transmit("Received program HMAC-SHA256 is incorrect!\n\r");
+		LOG_ERROR(LOG_MODULE_CORE, "Received program HMAC-SHA256 is incorrect!\n\r");
 		send_response(TYPE_FATAL_ERROR);
 		return;
 	}
 #endif
 
 	update_status = true;
-	update_status &= fvc_eeprom_write(EEPROM_BACKUP_PROGRAM_LEN, prog_len);
-	update_status &= fvc_eeprom_write(EEPROM_BACKUP_PROGRAM_HASH, prog_hash);
+	update_status &= commit_spare_backup(writer.len, writer.hash);
 
 finish:
 
 	if (update_status)
 	{
-		ctx.curr_mode = MODE_UPDATER;
-		bsp_updater_init();
-
-		if (!_copy_program_from_flash_to_memory())
+		if (_apply_buffered_update(header.firmware_id, writer.len, writer.hash))
 		{
-			debug_transmit("Failed to save new program!\n\r");
-			ctx.status = STATUS_PROGRAM_INVALID;
-
-			return;
+			send_response(TYPE_PROGRAM_UPDATE_FINISHED);
 		}
-
-		debug_transmit("Update finished. Executing app.\n\r");
-		jmp_to_app(APP_ADDR);
-		
-		fvc_eeprom_write(EEPROM_FIRMWARE_VERSION, new_firmware_id);
-		fvc_eeprom_write(EEPROM_PROGRAM_LEN, prog_len);
-		fvc_eeprom_write(EEPROM_PROGRAM_HASH, prog_hash);
-		ctx.status = STATUS_OK;
-
-		send_response(TYPE_PROGRAM_UPDATE_FINISHED);
-
-		ctx.curr_mode = MODE_SUPERVISOR;
-		supervisor_init(&ctx.sup, &bsp_spi_transmit, &bsp_spi_receive, &bsp_timer_start_refresh, &_reset_board);
 	}
 	else
 	{
 		send_response(TYPE_FATAL_ERROR);
 	}
 }
+
 #else
+// frames are written in 256 byte blocks, shorter non-final frame would shift rest of the image
+static bool _is_frame_block_aligned(struct update_header *header, size_t frame_counter, uint32_t received_len, size_t frame_len)
+{
+	return ((frame_len % 256) == 0) || _is_payload_complete(header, frame_counter + 1, received_len + frame_len);
+}
+
 static void _handle_update_program_request(struct protocol_frame *frame)
 {
-	debug_transmit("Updating board\n\r");
+	LOG_INFO(LOG_MODULE_CORE, "Updating board\n\r");
 	bool update_status = false;
 	uint32_t memory_addr = APP_ADDR;
-	uint8_t program_data[MAX_PROGRAM_DATA_LEN] = {0};
+	uint8_t program_data[MAX_PROGRAM_FRAME_LEN] = {0};
 	uint8_t validation_data[256] = {0};
 	size_t program_data_len = 0;
 
@@ -472,30 +1718,29 @@ static void _handle_update_program_request(struct protocol_frame *frame)
 #endif
 
 	uint8_t retry_counter = 0;
+	struct update_header header;
 
-	uint32_t new_firmware_id = ((((uint32_t) frame->payload_ptr[0]) << 24)
-			| (((uint32_t) frame->payload_ptr[1]) << 16)
-			| (((uint32_t) frame->payload_ptr[2]) << 8)
-			| ((uint32_t) frame->payload_ptr[3]));
-
-	uint32_t packet_count = ((((uint32_t) frame->payload_ptr[4]) << 24)
-			| (((uint32_t) frame->payload_ptr[5]) << 16)
-			| (((uint32_t) frame->payload_ptr[6]) << 8)
-			| ((uint32_t) frame->payload_ptr[7]));
+	_decode_header_data(frame, &header);
+	update_flags = header.flags;
 
-	uint8_t program_hmac_sha256[32] = {0};
-	memcpy(program_hmac_sha256, &frame->payload_ptr[8], 32);
+	uint32_t new_firmware_id = header.firmware_id;
 
 	uint32_t prog_len = 0;
 	uint32_t prog_hash = 0xFFFFFFFF;
 
-	UNUSED(new_firmware_id);
-
 	bsp_interface_abort_receive_IT();
 
-	if(!jmp_to_bootloader())
+	// patches, compressed streams and multicast sessions need W25Q to rebuild the image before flashing
+	if (header.flags & (UPDATE_FLAG_DELTA | UPDATE_FLAG_COMPRESSED | UPDATE_FLAG_MULTICAST))
+	{
+		LOG_ERROR(LOG_MODULE_CORE, "Delta, compressed and multicast updates require bufforing mode!\n\r");
+		send_response(TYPE_FATAL_ERROR);
+		return;
+	}
+
+	if(!bootloader_session_open())
 	{
-		debug_transmit("Update aborted, bootloader faliure!\n\r");
+		LOG_ERROR(LOG_MODULE_BOOTLOADER, "Update aborted, bootloader faliure!\n\r");
 		ctx.status = STATUS_BOOTLOADER_ERROR;
 		send_response(TYPE_FATAL_ERROR);
 		return;
@@ -504,47 +1749,55 @@ static void _handle_update_program_request(struct protocol_frame *frame)
 #if !CFG_IGNORE_BACKUP
 	if (ctx.status == STATUS_OK) 
 	{
-		debug_transmit("Validating current backup\n\r");
+		LOG_INFO(LOG_MODULE_BACKUP, "Validating current backup\n\r");
 
 		if (!validate_current_backup(true))
 		{
-			debug_transmit("Creating new backup\n\r");
+			LOG_INFO(LOG_MODULE_BACKUP, "Creating new backup\n\r");
 			if (!create_firmware_backup())
 			{
-				debug_transmit("Failed to create program backup\n\r");
+				LOG_ERROR(LOG_MODULE_BACKUP, "Failed to create program backup\n\r");
 				send_response(TYPE_FATAL_ERROR);
 				return;
 			} else {
-				debug_transmit("Backup has been created\n\r");
+				LOG_INFO(LOG_MODULE_BACKUP, "Backup has been created\n\r");
 			}
 		} else {
-			debug_transmit("Current backup is valid\n\r");
+			LOG_INFO(LOG_MODULE_BACKUP, "Current backup is valid\n\r");
 		}
 	}
 	else
 	{
-		debug_transmit("Current program invalid. Backup won't be created\n\r");
+		LOG_WARN(LOG_MODULE_BACKUP, "Current program invalid. Backup won't be created\n\r");
 	}
 #endif
 
+	_invalidate_verified_marker();
 	if (!erase_memory(0xFFFF, 0)) {
-		debug_transmit("Update aborted, memory faliure!\n\r");
+		LOG_ERROR(LOG_MODULE_BOOTLOADER, "Update aborted, memory faliure!\n\r");
 		ctx.status = STATUS_BOOTLOADER_ERROR;
 		send_response(TYPE_FATAL_ERROR);
 		return;
 	}
 
-	debug_transmit("Erased memory\n\r");
+	LOG_INFO(LOG_MODULE_BOOTLOADER, "Erased memory\n\r");
 
+	_link_stats_reset();
 	send_response(TYPE_ACK);
 
 	size_t counter = 0;
-	while(counter < packet_count)
+	while(!_is_payload_complete(&header, counter, prog_len))
 	{
 		program_data_len = _receive_and_deserialize_program_frame(program_data);
+		if (program_data_len && !_is_frame_block_aligned(&header, counter, prog_len, program_data_len))
+		{
+			LOG_WARN(LOG_MODULE_PROTOCOL, "Packet %d not aligned to 256 bytes\n\r", counter);
+			program_data_len = 0;
+		}
+
 		if (program_data_len)
 		{
-			debug_transmit("Received packet %d\n\r", counter);
+			LOG_DEBUG(LOG_MODULE_PROTOCOL, "Received packet %d\n\r", counter);
 
 			// TODO: sumarize program length anbd crc
 			prog_len += program_data_len;
@@ -554,13 +1807,15 @@ static void _handle_update_program_request(struct protocol_frame *frame)
 			fvc_calc_hmac_sha256_write_data(program_data, program_data_len);
 #endif
 
+			// only last frame can be shorter, its written part is padded to full block
+			size_t write_len = (program_data_len + 255) & ~((size_t) 255);
 			if ((program_data_len % 256) != 0)
 			{
-				memset(&program_data[program_data_len], 0xFF, MAX_PROGRAM_DATA_LEN - program_data_len);
+				memset(&program_data[program_data_len], 0xFF, write_len - program_data_len);
 			}
 
 			size_t iterator = 0;
-			while(iterator < MAX_PROGRAM_DATA_LEN) {
+			while(iterator < write_len) {
 
 				if (write_memory(memory_addr, &program_data[iterator], 256)) {
 
@@ -573,19 +1828,20 @@ static void _handle_update_program_request(struct protocol_frame *frame)
 							iterator += 256;
 						}
 					} else {
-						jmp_to_bootloader();
+						bootloader_session_recover();
 					}
 				} else {
-					jmp_to_bootloader();
+					bootloader_session_recover();
 				}
 			}
 			counter++;
-			send_response(TYPE_ACK);
+			retry_counter = 0;
+			_send_program_response(TYPE_ACK);
 		}
 		else
 		{
 			retry_counter++;
-			debug_transmit("Failed to receive packet %d\n\r", counter);
+			LOG_WARN(LOG_MODULE_PROTOCOL, "Failed to receive packet %d\n\r", counter);
 
 			if(retry_counter > 3)
 			{
@@ -594,14 +1850,14 @@ static void _handle_update_program_request(struct protocol_frame *frame)
 			}
 			else
 			{
-				send_response(TYPE_NACK);
+				_send_program_response(TYPE_NACK);
 			}
 		}
 	}
 
 #if !CFG_IGNORE_PROGRAM_HASH
 	fvc_calc_hmac_sha256_end_calc(calc_program_hmac_sha256);
-	if (memcmp(calc_program_hmac_sha256, program_hmac_sha256, 32) == 0) 
+	if (memcmp(calc_program_hmac_sha256, header.hmac_sha256, 32) == 0) 
 	{
 #endif
 
@@ -612,7 +1868,7 @@ static void _handle_update_program_request(struct protocol_frame *frame)
 	fvc_eeprom_write(EEPROM_PROGRAM_LEN, prog_len);
 	fvc_eeprom_write(EEPROM_PROGRAM_HASH, prog_hash);
 
-	debug_transmit("Update finished. Executiong app.\n\r");
+	LOG_INFO(LOG_MODULE_CORE, "Update finished. Executiong app.\n\r");
 	jmp_to_app(APP_ADDR);
 
 #if !CFG_IGNORE_PROGRAM_HASH
@@ -620,7 +1876,7 @@ static void _handle_update_program_request(struct protocol_frame *frame)
 	else
 	{
 		ctx.status = STATUS_PROGRAM_INVALID;
-		debug_transmit("Program hash is incorrect!\n\r");
+		LOG_ERROR(LOG_MODULE_CORE, "Program hash is incorrect!\n\r");
 	}
 #endif
 
@@ -628,10 +1884,10 @@ finish:
 
 	if (!update_status)
 	{
-		debug_transmit("Update failed, returning to old program.\n\r");
+		LOG_WARN(LOG_MODULE_CORE, "Update failed, returning to old program.\n\r");
 		if (!_copy_program_from_flash_to_memory())
 		{
-			debug_transmit("Failed to return to old program!\n\r");
+			LOG_ERROR(LOG_MODULE_BACKUP, "Failed to return to old program!\n\r");
 			ctx.status = STATUS_PROGRAM_INVALID;
 		}
 	}
@@ -648,40 +1904,40 @@ static void _print_program_statistics(void)
 			&& fvc_eeprom_read(EEPROM_PROGRAM_LEN, &firmware_len)
 			&& fvc_eeprom_read(EEPROM_PROGRAM_HASH, &formware_hash))
 	{
-		debug_transmit("Firmware statistics:\n\rFirmware version: %X\n\rFirmware length: %d\n\rFirmware hash: %X\n\r", firmware_version, firmware_len, formware_hash);
+		LOG_INFO(LOG_MODULE_CORE, "Firmware statistics:\n\rFirmware version: %X\n\rFirmware length: %d\n\rFirmware hash: %X\n\r", firmware_version, firmware_len, formware_hash);
 	}
 }
 
 static bool _default_board_init(void)
 {
-	debug_transmit("Connecting to bootlaoder...\n\r");
-	if (!jmp_to_bootloader())
+	LOG_INFO(LOG_MODULE_BOOTLOADER, "Connecting to bootlaoder...\n\r");
+	if (!bootloader_session_open())
 	{
-		debug_transmit("ERROR: Bootloader connection failed\n\r");
+		LOG_ERROR(LOG_MODULE_BOOTLOADER, "ERROR: Bootloader connection failed\n\r");
 		bsp_reset_gpio_controll(GPIO_RESET);
 		ctx.status = STATUS_BOOTLOADER_ERROR;
 		return false;
 	} else {
-		debug_transmit("Connected\n\r");
+		LOG_INFO(LOG_MODULE_BOOTLOADER, "Connected\n\r");
 	}
 
-	debug_transmit("Valdiating program...\n\r");
+	LOG_INFO(LOG_MODULE_BOOTLOADER, "Valdiating program...\n\r");
 	if (!_is_app_present_and_valid()) {
-		debug_transmit("WARNING: Validation failed\n\r");
+		LOG_WARN(LOG_MODULE_BOOTLOADER, "WARNING: Validation failed\n\r");
 		ctx.status = STATUS_PROGRAM_INVALID;
 		return false;
 	} else {
-		debug_transmit("Validation successful\n\r");
+		LOG_INFO(LOG_MODULE_BOOTLOADER, "Validation successful\n\r");
 	}
 
-	debug_transmit("Launching program...\n\r");
+	LOG_INFO(LOG_MODULE_BOOTLOADER, "Launching program...\n\r");
 	if (!jmp_to_app(APP_ADDR)) {
-		debug_transmit("WARNING: Application execution failed\n\r");
+		LOG_WARN(LOG_MODULE_BOOTLOADER, "WARNING: Application execution failed\n\r");
 		ctx.status = STATUS_EXECUTION_ERROR;
 		return false;
 	} else {
 		ctx.status = STATUS_OK;
-		debug_transmit("Application started\n\r");
+		LOG_INFO(LOG_MODULE_BOOTLOADER, "Application started\n\r");
 	}
 
 	_print_program_statistics();
@@ -689,23 +1945,115 @@ static bool _default_board_init(void)
 	return true;
 }
 
+static void _handle_id_request(void)
+{
+	uint8_t payload[ID_RESP_LEN] = {0};
+	uint32_t firmware_version = 0;
+
+	fvc_eeprom_read(EEPROM_FIRMWARE_VERSION, &firmware_version);
+
+	payload[0] = PROTOCOL_VERSION;
+	_encode_u32(&payload[1], firmware_version);
+	payload[5] = (uint8_t) (MAX_PROGRAM_DATA_LEN >> 8);
+	payload[6] = (uint8_t) MAX_PROGRAM_DATA_LEN;
+	payload[7] = FRAME_WINDOW_SIZE;
+	payload[8] = UPDATE_FLAG_FEC;
+#if CFG_BUFFORING_MODE
+	payload[8] |= UPDATE_FLAG_DELTA | UPDATE_FLAG_COMPRESSED | UPDATE_FLAG_MULTICAST | UPDATE_FLAG_RESUME;
+#endif
+	_encode_u32(&payload[9], bsp_interface_get_max_baudrate());
+	_encode_u32(&payload[13], ctx.default_baudrate);
+#if BSP_INTERFACE_ADDRESS_MARK
+	payload[17] = CAPABILITY_ADDRESS_MARK;
+#endif
+
+	send_frame(TYPE_ID_RESP, payload, sizeof(payload));
+}
+
+static void _handle_baud_switch_request(struct protocol_frame *frame)
+{
+	uint8_t data[CLI_BUFFOR_LEN] = {0};
+	uint8_t payload[CLI_BUFFOR_LEN] = {0};
+	struct protocol_frame probe;
+	uint32_t old_baudrate = bsp_interface_get_baudrate();
+
+	probe.payload_ptr = payload;
+
+	if ((frame->payload_len < 4) || !bsp_interface_is_baudrate_supported(_decode_u32(frame->payload_ptr)))
+	{
+		send_response(TYPE_NACK);
+		return;
+	}
+
+	uint32_t baudrate = _decode_u32(frame->payload_ptr);
+
+	// ACK is sent at old rate, it has to leave TX queue before switch
+	bsp_interface_abort_receive_IT();
+	send_response(TYPE_ACK);
+	flush_transmit(TX_FLUSH_TIMEOUT_MS);
+
+	if (bsp_interface_set_baudrate(baudrate)
+			&& bsp_interface_receive(data, sizeof(data))
+			&& frame_deserialize(&probe, data, sizeof(data))
+			&& (probe.destination_id == ctx.board_id)
+			&& (probe.data_type == TYPE_BAUD_SWITCH_PROBE))
+	{
+		send_response(TYPE_ACK);
+		LOG_INFO(LOG_MODULE_PROTOCOL, "Interface switched to %d baud\n\r", baudrate);
+		return;
+	}
+
+	// host did not confirm new rate
+	flush_transmit(TX_FLUSH_TIMEOUT_MS);
+	bsp_interface_set_baudrate(old_baudrate);
+}
+
+static void _handle_baudrate_timeout(void)
+{
+	if ((bsp_interface_get_baudrate() != ctx.default_baudrate)
+			&& ((HAL_GetTick() - ctx.last_frame_tick) > BAUD_IDLE_REVERT_MS))
+	{
+		flush_transmit(TX_FLUSH_TIMEOUT_MS);
+		bsp_interface_set_baudrate(ctx.default_baudrate);
+		_interface_callback_handler(0);
+		LOG_INFO(LOG_MODULE_PROTOCOL, "Host silent, interface back at %d baud\n\r", ctx.default_baudrate);
+	}
+}
+
 static void _process_msg(void)
 {
 	uint8_t data[CLI_BUFFOR_LEN] = {0};
 	struct protocol_frame frame;
 	frame.payload_ptr = data;
+	uint8_t response;
+
+	while (fvc_queue_pop(&interface_tx_queue, &response)) {
+		send_response((enum payload_type) response);
+	}
 
-	if (ctx.interface_cli_data_present) {
-		if (frame_deserialize(&frame, ctx.interface_cli_data, CLI_BUFFOR_LEN)) {
+	struct interface_rx_frame *rx = fvc_queue_peek(&interface_rx_queue);
+	if (rx != NULL) {
+		// bytes behind received frame are not valid
+		memset(&rx->data[rx->len], 0, CLI_BUFFOR_LEN - rx->len);
+
+		// bus is shared, frames for other boards and groups are dropped without response
+		if (rx->data[PROTOCOL_DST_ID_POS] != ctx.board_id) {
+			;
+		} else if (frame_deserialize(&frame, rx->data, CLI_BUFFOR_LEN)) {
 			_execute_frame_response(&frame);
+			ctx.last_frame_tick = HAL_GetTick();
 		} else {
 			send_response(false);
 		}
 
-		memset(ctx.interface_cli_data, 0, CLI_BUFFOR_LEN);
-		ctx.interface_cli_data_present = false;
+		fvc_queue_release(&interface_rx_queue);
 
 		_interface_callback_handler(0);
+
+		// one frame per run, supervisor is not delayed by a burst of frames
+		if (fvc_queue_peek(&interface_rx_queue) != NULL) {
+			fvc_sched_post(&protocol_task);
+		}
 	}
 }
 
@@ -717,25 +2065,55 @@ static void _handle_invalid_program(void)
 		bsp_timer_stop();
 		bsp_updater_init();
 
-		debug_transmit("Current firmware invalid. Restoring program from backup.\n\r");
+		LOG_WARN(LOG_MODULE_BACKUP, "Current firmware invalid. Restoring program from backup.\n\r");
 		if (_copy_program_from_flash_to_memory())
 		{
+			const struct bootloader_session *session = bootloader_session_get();
+			LOG_DEBUG(LOG_MODULE_BOOTLOADER, "Bootloader session: %d resets, %d retries, %d probes\n\r", session->resets, session->retries, session->probes);
+
 			jmp_to_app(APP_ADDR);
 			ctx.status = STATUS_OK;
-			debug_transmit("Firmware restored.\n\r");
+			LOG_INFO(LOG_MODULE_BACKUP, "Firmware restored.\n\r");
 		
 			ctx.curr_mode = MODE_SUPERVISOR;
-			supervisor_init(&ctx.sup, &bsp_spi_transmit, &bsp_spi_receive, &bsp_timer_start_refresh, &_reset_board);
+			supervisor_init(&ctx.sup, &bsp_spi_transmit_IT, &bsp_spi_receive_IT, &bsp_spi_abort, &bsp_timer_start_refresh, &bsp_timer_get_elapsed_us, &_reset_board);
 		}
 		else
 		{
-			debug_transmit("Failed to restore firmware.\n\r");
+			LOG_ERROR(LOG_MODULE_BACKUP, "Failed to restore firmware.\n\r");
+		}
+	}
+}
+
+static void _supervisor_task(void)
+{
+	uint8_t event;
+
+	while (fvc_queue_pop(&timer_event_queue, &event))
+	{
+		if (event == TIMER_EVENT_SUPERVISION_EXPIRED)
+		{
+			supervisor_timer_period_elapsed_callback(&ctx.sup);
 		}
 	}
+
+	if (ctx.curr_mode == MODE_SUPERVISOR)
+	{
+		supervisor_loop(&ctx.sup);
+	}
+}
+
+static void _eeprom_task(void)
+{
+	if (fvc_eeprom_is_cleanup_required() && !fvc_eeprom_cleanup())
+	{
+		LOG_ERROR(LOG_MODULE_CORE, "EEPROM cleanup failed\n\r");
+	}
 }
 
 static void _reset_board(void)
 {
+    bootloader_session_close();
     bsp_reset_gpio_controll(GPIO_RESET);
     HAL_Delay(10);
     bsp_reset_gpio_controll(GPIO_SET);
@@ -747,10 +2125,13 @@ static void _reset_board(void)
 bool fvc_main(void)
 {
 	bsp_initi_gpio();
+	bsp_cycle_counter_init();
 	fvc_led_init();
 
 	bsp_interface_init(_interface_callback_handler);
 	bsp_timer_init(_timer_elapsed_callback_handler);
+	bsp_spi_init(_spi_callback_handler);
+	ctx.default_baudrate = bsp_interface_get_baudrate();
 
 	if (!fvc_eeprom_initialize())
 	{
@@ -758,11 +2139,11 @@ bool fvc_main(void)
 	}
 
 	fvc_eeprom_write(EEPROM_ID_ADDR, 1);
-	fvc_eeprom_write(EEPROM_CONFIG, 3);
+	fvc_eeprom_write(EEPROM_CONFIG, CONFIG_DEBUG_MASK | CONFIG_DEFERRED_LOG);
 
 	_get_board_info();
 
-	debug_transmit("FVC Init\n\r");
+	LOG_INFO(LOG_MODULE_CORE, "FVC Init\n\r");
 
 	if(W25Q_Init() != W25Q_OK)
 	{
@@ -778,25 +2159,27 @@ bool fvc_main(void)
 
 	if (!_default_board_init())
 	{
-		debug_transmit("WARNING: program could not be started\n\r");
+		LOG_WARN(LOG_MODULE_CORE, "WARNING: program could not be started\n\r");
 	} 
 	else
 	{
 		ctx.curr_mode = MODE_SUPERVISOR;
-		supervisor_init(&ctx.sup, &bsp_spi_transmit, &bsp_spi_receive, &bsp_timer_start_refresh, &_reset_board);
+		supervisor_init(&ctx.sup, &bsp_spi_transmit_IT, &bsp_spi_receive_IT, &bsp_spi_abort, &bsp_timer_start_refresh, &bsp_timer_get_elapsed_us, &_reset_board);
 	}
 
+	fvc_sched_add(&supervisor_task);
+	fvc_sched_add(&protocol_task);
+	fvc_sched_add(&program_task);
+	fvc_sched_add(&link_task);
+	fvc_sched_add(&scrubber_task);
+	fvc_sched_add(&eeprom_task);
+	fvc_sched_add(&log_task);
+
 	fvc_led_cli_blink(true);
-	debug_transmit("Started CLI\n\r");
+	LOG_INFO(LOG_MODULE_CORE, "Started CLI\n\r");
 	while(1)
 	{
-		_handle_invalid_program();
-		_process_msg();
-
-		if (ctx.curr_mode == MODE_SUPERVISOR)
-		{
-			supervisor_loop(&ctx.sup);
-		}
+		fvc_sched_run();
 
 		//fvc_led_cli_blink();
 	}
@@ -14,6 +14,20 @@
 
 #define CFG_IGNORE_PROGRAM_HASH	    0
 
+// program only target pages that differ from backup image (requires CFG_BUFFORING_MODE)
+#define CFG_INCREMENTAL_FLASHING    1
+
+// start verified image after spot check against backup, backup is verified in background
+#define CFG_FAST_BOOT               1
+
+// lowest log severity compiled in (LOG_LEVEL_* in fvc_log.h), LOG_LEVEL_TRACE instruments hot loops
+#define CFG_LOG_LEVEL               LOG_LEVEL_INFO
+// modules with logging compiled in (LOG_MODULE_* in fvc_log.h)
+#define CFG_LOG_MODULES             LOG_MODULE_ALL
+
+#define TARGET_FLASH_PAGE_SIZE      (2*1024)
+#define TARGET_FLASH_PAGE_NB        256
+
 bool fvc_main(void);
 
 #endif
@@ -12,6 +12,62 @@
 
 #include <stdint.h>
 
+#define W25Q_BLOCK_SIZE		(MEM_BLOCK_SIZE * 1024U)
+
+// every slot keeps its own metadata, slot selector is written last so reset never mixes them
+static const enum eeprom_addr slot_len_addr[BACKUP_SLOT_NB] = {EEPROM_BACKUP_PROGRAM_LEN, EEPROM_BACKUP1_PROGRAM_LEN};
+static const enum eeprom_addr slot_hash_addr[BACKUP_SLOT_NB] = {EEPROM_BACKUP_PROGRAM_HASH, EEPROM_BACKUP1_PROGRAM_HASH};
+
+static uint32_t _get_active_slot(void)
+{
+	uint32_t slot = 0;
+	if (!fvc_eeprom_read(EEPROM_BACKUP_SLOT, &slot) || (slot >= BACKUP_SLOT_NB))
+	{
+		slot = 0;
+	}
+	return slot;
+}
+
+uint32_t get_backup_addr(void)
+{
+	return _get_active_slot() * BACKUP_SLOT_SIZE;
+}
+
+uint32_t get_spare_backup_addr(void)
+{
+	return ((_get_active_slot() + 1) % BACKUP_SLOT_NB) * BACKUP_SLOT_SIZE;
+}
+
+bool erase_spare_backup(void)
+{
+	uint32_t first_block = get_spare_backup_addr() / W25Q_BLOCK_SIZE;
+
+	for (uint32_t block = first_block; block < first_block + (BACKUP_SLOT_SIZE / W25Q_BLOCK_SIZE); block++)
+	{
+		if (W25Q_EraseBlock(block, MEM_BLOCK_SIZE) != W25Q_OK)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool get_backup_info(uint32_t *len, uint32_t *hash)
+{
+	uint32_t slot = _get_active_slot();
+
+	return fvc_eeprom_read(slot_len_addr[slot], len) && fvc_eeprom_read(slot_hash_addr[slot], hash);
+}
+
+bool commit_spare_backup(uint32_t len, uint32_t hash)
+{
+	uint32_t spare = (_get_active_slot() + 1) % BACKUP_SLOT_NB;
+
+	return fvc_eeprom_write(slot_len_addr[spare], len)
+			&& fvc_eeprom_write(slot_hash_addr[spare], hash)
+			&& fvc_eeprom_write(EEPROM_BACKUP_SLOT, spare);
+}
+
 bool create_firmware_backup(void)
 {
 	uint32_t prog_len, prog_hash;
@@ -22,14 +78,15 @@ bool create_firmware_backup(void)
 		return false;
 	}
 
-	if (!fvc_eeprom_write(EEPROM_BACKUP_PROGRAM_LEN, prog_len) || !fvc_eeprom_write(EEPROM_BACKUP_PROGRAM_HASH, prog_hash)) {
+	if (prog_len > BACKUP_SLOT_SIZE)
+	{
 		return false;
 	}
 
 	uint32_t current_addr = APP_ADDR;
-	uint32_t ext_flash_addr = 0;
+	uint32_t ext_flash_addr = get_spare_backup_addr();
 
-	if (W25Q_EraseChip() != W25Q_OK)
+	if (!erase_spare_backup())
 	{
 		return false;
 	}
@@ -55,7 +112,7 @@ bool create_firmware_backup(void)
 			}
 
 		} else {
-			jmp_to_bootloader();
+			bootloader_session_recover();
 		}
 
 		if (W25Q_IsBusy() == W25Q_BUSY)
@@ -64,7 +121,7 @@ bool create_firmware_backup(void)
 		}
 	}
 
-	return true;
+	return commit_spare_backup(prog_len, prog_hash);
 }
 
 bool validate_current_backup(bool compare_with_current_program)
@@ -73,7 +130,7 @@ bool validate_current_backup(bool compare_with_current_program)
 	uint32_t current_prog_len, current_prog_hash;
 	uint8_t flash_data[256];
 
-	if (!fvc_eeprom_read(EEPROM_BACKUP_PROGRAM_LEN, &prog_len) || !fvc_eeprom_read(EEPROM_BACKUP_PROGRAM_HASH, &prog_hash))
+	if (!get_backup_info(&prog_len, &prog_hash))
 	{
 		return false;
 	}
@@ -93,6 +150,7 @@ bool validate_current_backup(bool compare_with_current_program)
 
 	uint32_t calc_hash = 0xFFFFFFFF;
 	uint32_t ext_flash_addr = 0;
+	uint32_t backup_addr = get_backup_addr();
 
 	while(ext_flash_addr < prog_len)
 	{
@@ -105,7 +163,7 @@ bool validate_current_backup(bool compare_with_current_program)
 			read_len = 256;
 		}
 
-		if (W25Q_ReadRaw(flash_data, 256, ext_flash_addr) == W25Q_OK)
+		if (W25Q_ReadRaw(flash_data, 256, backup_addr + ext_flash_addr) == W25Q_OK)
 		{
 			calc_hash = fvc_calc_crc(calc_hash, flash_data, read_len);
 			ext_flash_addr += read_len;
@@ -119,3 +177,22 @@ bool validate_current_backup(bool compare_with_current_program)
 
 	return prog_hash == calc_hash;
 }
+
+bool calc_backup_page_digest(uint32_t page_addr, uint32_t *digest)
+{
+	uint8_t flash_data[256];
+	uint32_t calc_hash = 0xFFFFFFFF;
+	uint32_t backup_addr = get_backup_addr();
+
+	for (uint32_t offset = 0; offset < TARGET_FLASH_PAGE_SIZE; offset += 256)
+	{
+		if (W25Q_ReadRaw(flash_data, 256, backup_addr + page_addr + offset) != W25Q_OK)
+		{
+			return false;
+		}
+		calc_hash = fvc_calc_crc(calc_hash, flash_data, 256);
+	}
+
+	*digest = calc_hash;
+	return true;
+}
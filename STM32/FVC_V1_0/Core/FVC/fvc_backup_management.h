@@ -3,8 +3,21 @@
 #define BACKUP_MANAGEMENT_H
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "fvc.h"
+
+#define BACKUP_SLOT_SIZE	(TARGET_FLASH_PAGE_SIZE * TARGET_FLASH_PAGE_NB)
+#define BACKUP_SLOT_NB		2
+
+uint32_t get_backup_addr(void);
+uint32_t get_spare_backup_addr(void);
+bool erase_spare_backup(void);
+bool get_backup_info(uint32_t *len, uint32_t *hash);
+bool commit_spare_backup(uint32_t len, uint32_t hash);
 
 bool create_firmware_backup(void);
 bool validate_current_backup(bool compare_with_current_program);
+bool calc_backup_page_digest(uint32_t page_addr, uint32_t *digest);
 
 #endif
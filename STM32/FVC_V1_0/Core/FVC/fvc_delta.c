@@ -0,0 +1,136 @@
+#include "fvc_delta.h"
+
+#include "W25Q_Driver/Library/w25q_mem.h"
+
+#define COPY_CHUNK_LEN		256
+
+static size_t _get_args_len(uint8_t op)
+{
+	switch (op) {
+		case DELTA_OP_COPY:
+			return 6;
+		case DELTA_OP_INSERT:
+			return 2;
+		default:
+			return 0;
+	}
+}
+
+static bool _copy_from_base(struct fvc_delta *delta, uint32_t offset, uint32_t len)
+{
+	uint8_t buff[COPY_CHUNK_LEN];
+
+	if ((offset > delta->base_len) || (len > delta->base_len - offset))
+	{
+		return false;
+	}
+
+	while (len > 0)
+	{
+		uint16_t chunk_len = (len > COPY_CHUNK_LEN) ? COPY_CHUNK_LEN : (uint16_t) len;
+
+		if (W25Q_ReadRaw(buff, chunk_len, delta->base_addr + offset) != W25Q_OK)
+		{
+			return false;
+		}
+
+		if (!delta->output(buff, chunk_len))
+		{
+			return false;
+		}
+
+		offset += chunk_len;
+		len -= chunk_len;
+	}
+	return true;
+}
+
+static bool _execute_op(struct fvc_delta *delta)
+{
+	uint8_t *args = delta->args;
+
+	if (delta->op == DELTA_OP_COPY)
+	{
+		uint32_t offset = ((((uint32_t) args[0]) << 24)
+				| (((uint32_t) args[1]) << 16)
+				| (((uint32_t) args[2]) << 8)
+				| ((uint32_t) args[3]));
+		uint32_t len = (((uint32_t) args[4]) << 8) | ((uint32_t) args[5]);
+
+		delta->state = DELTA_STATE_OP;
+		return _copy_from_base(delta, offset, len);
+	}
+
+	delta->insert_remaining = (((uint32_t) args[0]) << 8) | ((uint32_t) args[1]);
+	delta->state = (delta->insert_remaining > 0) ? DELTA_STATE_INSERT : DELTA_STATE_OP;
+	return true;
+}
+
+void fvc_delta_init(struct fvc_delta *delta, uint32_t base_addr, uint32_t base_len, delta_output_t output)
+{
+	delta->state = DELTA_STATE_OP;
+	delta->op = 0;
+	delta->args_len = 0;
+	delta->args_needed = 0;
+	delta->insert_remaining = 0;
+
+	delta->base_addr = base_addr;
+	delta->base_len = base_len;
+	delta->output = output;
+}
+
+bool fvc_delta_write(struct fvc_delta *delta, uint8_t *data, size_t data_len)
+{
+	size_t iterator = 0;
+
+	while ((iterator < data_len) && (delta->state != DELTA_STATE_ERROR))
+	{
+		switch (delta->state) {
+			case DELTA_STATE_OP:
+				delta->op = data[iterator++];
+				delta->args_len = 0;
+				delta->args_needed = _get_args_len(delta->op);
+				delta->state = (delta->args_needed > 0) ? DELTA_STATE_ARGS : DELTA_STATE_ERROR;
+				break;
+			case DELTA_STATE_ARGS:
+				delta->args[delta->args_len++] = data[iterator++];
+				if ((delta->args_len == delta->args_needed) && !_execute_op(delta))
+				{
+					delta->state = DELTA_STATE_ERROR;
+				}
+				break;
+			case DELTA_STATE_INSERT:
+			{
+				size_t chunk_len = data_len - iterator;
+				if (chunk_len > delta->insert_remaining)
+				{
+					chunk_len = delta->insert_remaining;
+				}
+
+				if (!delta->output(&data[iterator], chunk_len))
+				{
+					delta->state = DELTA_STATE_ERROR;
+					break;
+				}
+
+				iterator += chunk_len;
+				delta->insert_remaining -= chunk_len;
+				if (delta->insert_remaining == 0)
+				{
+					delta->state = DELTA_STATE_OP;
+				}
+				break;
+			}
+			default:
+				delta->state = DELTA_STATE_ERROR;
+				break;
+		}
+	}
+
+	return delta->state != DELTA_STATE_ERROR;
+}
+
+bool fvc_delta_finish(struct fvc_delta *delta)
+{
+	return delta->state == DELTA_STATE_OP;
+}
@@ -0,0 +1,67 @@
+#ifndef FVC_DELTA_H
+#define FVC_DELTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Delta patch format, all values big endian:
+ *  DELTA_OP_COPY   (1B), base offset (4B), length (2B) - copy bytes from base image
+ *  DELTA_OP_INSERT (1B), length (2B), data (length B)   - append literal bytes
+ */
+#define DELTA_OP_COPY		0x01
+#define DELTA_OP_INSERT		0x02
+
+typedef bool (*delta_output_t)(uint8_t *data, size_t data_len);
+
+enum delta_state
+{
+	DELTA_STATE_OP = 0,
+	DELTA_STATE_ARGS,
+	DELTA_STATE_INSERT,
+	DELTA_STATE_ERROR,
+
+	DELTA_STATE_TOP
+};
+
+struct fvc_delta
+{
+	enum delta_state state;
+	uint8_t op;
+	uint8_t args[6];
+	size_t args_len;
+	size_t args_needed;
+	uint32_t insert_remaining;
+
+	uint32_t base_addr;
+	uint32_t base_len;
+	delta_output_t output;
+};
+
+/**
+ * @brief Initialize streaming patch engine
+ * @param [in] delta - engine context
+ * @param [in] base_addr - W25Q address of base image
+ * @param [in] base_len - length of base image
+ * @param [in] output - sink for reconstructed image data
+ */
+void fvc_delta_init(struct fvc_delta *delta, uint32_t base_addr, uint32_t base_len, delta_output_t output);
+
+/**
+ * @brief Applies next part of patch stream, operations may span between calls
+ * @param [in] delta - engine context
+ * @param [in] data - patch data
+ * @param [in] data_len - length of patch data
+ * @return false if patch is malformed or output failed
+ */
+bool fvc_delta_write(struct fvc_delta *delta, uint8_t *data, size_t data_len);
+
+/**
+ * @brief Checks if patch stream ended on operation boundary
+ * @param [in] delta - engine context
+ * @return true if whole patch was applied
+ */
+bool fvc_delta_finish(struct fvc_delta *delta);
+
+#endif
@@ -5,6 +5,8 @@
 
 #define EEPROM_ADDR 0xA0
 
+static bool cleanup_required = false;
+
 bool fvc_eeprom_initialize(void)
 {
 	HAL_FLASH_Unlock();
@@ -29,6 +31,33 @@ bool fvc_eeprom_write(enum eeprom_addr addr, uint32_t data)
 	if (data == current_data) {
 		return true;
 	}
+	// long handlers (updates with resume checkpoints) block background cleanup,
+	// next page could fill up with previous one still not erased
+	if (cleanup_required && !fvc_eeprom_cleanup()) {
+		return false;
+	}
 	status = EE_WriteVariable32bits((uint16_t) addr, data);
+	if (status == EE_CLEANUP_REQUIRED) {
+		// value is written, erasing full page is left for background cleanup
+		cleanup_required = true;
+		return true;
+	}
+	return status == EE_OK;
+}
+
+bool fvc_eeprom_is_cleanup_required(void)
+{
+	return cleanup_required;
+}
+
+bool fvc_eeprom_cleanup(void)
+{
+	if (!cleanup_required) {
+		return true;
+	}
+	EE_Status status = EE_CleanUp();
+	if (status == EE_OK) {
+		cleanup_required = false;
+	}
 	return status == EE_OK;
 }
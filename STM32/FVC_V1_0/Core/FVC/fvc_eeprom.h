@@ -11,8 +11,29 @@ enum eeprom_addr
 	EEPROM_CONFIG,
 	EEPROM_PROGRAM_LEN,
 	EEPROM_PROGRAM_HASH,
+	// backup slot 0, use get_backup_info for active slot
 	EEPROM_BACKUP_PROGRAM_LEN,
 	EEPROM_BACKUP_PROGRAM_HASH,
+	EEPROM_BACKUP_SLOT,
+	// checkpoint of interrupted update, order matches struct resume_checkpoint
+	EEPROM_RESUME_SESSION,
+	EEPROM_RESUME_OFFSET,
+	EEPROM_RESUME_FRAMES,
+	EEPROM_RESUME_CRC,
+	EEPROM_RESUME_SHA_STATE,
+	EEPROM_RESUME_SHA_STATE_END = EEPROM_RESUME_SHA_STATE + 7,
+	EEPROM_RESUME_CHECK,
+	// fast boot marker, valid only while target flash generation is unchanged
+	EEPROM_FLASH_GENERATION,
+	EEPROM_VERIFIED_GENERATION,
+	EEPROM_VERIFIED_HASH,
+	EEPROM_BOOT_COUNT,
+	// last scrubber pass per region: result, boot count, uptime [s]
+	EEPROM_SCRUB_RECORDS,
+	EEPROM_SCRUB_RECORDS_END = EEPROM_SCRUB_RECORDS + 5,
+	// backup slot 1
+	EEPROM_BACKUP1_PROGRAM_LEN,
+	EEPROM_BACKUP1_PROGRAM_HASH,
 
 	EEPROM_TOP
 };
@@ -20,6 +41,8 @@ enum eeprom_addr
 bool fvc_eeprom_initialize(void);
 bool fvc_eeprom_read(enum eeprom_addr addr, uint32_t *data);
 bool fvc_eeprom_write(enum eeprom_addr addr, uint32_t data);
+bool fvc_eeprom_is_cleanup_required(void);
+bool fvc_eeprom_cleanup(void);
 
 #endif
 
@@ -0,0 +1,285 @@
+#include "fvc_fec.h"
+
+#include <string.h>
+
+#define GF_PRIMITIVE_POLY		0x11D
+#define GF_ORDER				255
+#define MAX_ERRORS				(FEC_PARITY_LEN / 2)
+
+static uint8_t gf_exp[2 * GF_ORDER];
+static uint8_t gf_log[GF_ORDER + 1];
+static bool gf_tables_ready = false;
+
+static void _init_tables(void)
+{
+	uint16_t value = 1;
+
+	for (size_t i = 0; i < GF_ORDER; i++)
+	{
+		gf_exp[i] = (uint8_t) value;
+		gf_exp[i + GF_ORDER] = (uint8_t) value;
+		gf_log[value] = (uint8_t) i;
+
+		value <<= 1;
+		if (value & 0x100)
+		{
+			value ^= GF_PRIMITIVE_POLY;
+		}
+	}
+
+	gf_tables_ready = true;
+}
+
+static inline uint8_t _gf_mul(uint8_t a, uint8_t b)
+{
+	if ((a == 0) || (b == 0))
+	{
+		return 0;
+	}
+
+	return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static inline uint8_t _gf_div(uint8_t a, uint8_t b)
+{
+	if (a == 0)
+	{
+		return 0;
+	}
+
+	return gf_exp[gf_log[a] + GF_ORDER - gf_log[b]];
+}
+
+// a^power, power in range 0 .. GF_ORDER - 1
+static inline uint8_t _gf_pow_a(size_t power)
+{
+	return gf_exp[power % GF_ORDER];
+}
+
+static uint8_t _poly_eval(uint8_t *poly, size_t degree, uint8_t x)
+{
+	uint8_t result = poly[degree];
+
+	for (size_t i = degree; i > 0; i--)
+	{
+		result = _gf_mul(result, x) ^ poly[i - 1];
+	}
+
+	return result;
+}
+
+// first byte of codeword is coefficient of highest power
+static bool _calc_syndromes(uint8_t *codeword, size_t len, uint8_t *syndromes)
+{
+	uint8_t errors = 0;
+
+	memset(syndromes, 0, FEC_PARITY_LEN);
+
+	for (size_t i = 0; i < len; i++)
+	{
+		for (size_t j = 0; j < FEC_PARITY_LEN; j++)
+		{
+			uint8_t s = syndromes[j];
+			syndromes[j] = (s ? gf_exp[gf_log[s] + j] : 0) ^ codeword[i];
+		}
+	}
+
+	for (size_t j = 0; j < FEC_PARITY_LEN; j++)
+	{
+		errors |= syndromes[j];
+	}
+
+	return errors != 0;
+}
+
+// Berlekamp-Massey, returns degree of error locator
+static size_t _find_error_locator(uint8_t *syndromes, uint8_t *locator)
+{
+	uint8_t prev[FEC_PARITY_LEN + 1] = {1};
+	uint8_t temp[FEC_PARITY_LEN + 1];
+	size_t degree = 0;
+	size_t shift = 1;
+	uint8_t prev_discrepancy = 1;
+
+	memset(locator, 0, FEC_PARITY_LEN + 1);
+	locator[0] = 1;
+
+	for (size_t n = 0; n < FEC_PARITY_LEN; n++)
+	{
+		uint8_t discrepancy = syndromes[n];
+
+		for (size_t i = 1; i <= degree; i++)
+		{
+			discrepancy ^= _gf_mul(locator[i], syndromes[n - i]);
+		}
+
+		if (discrepancy == 0)
+		{
+			shift++;
+			continue;
+		}
+
+		uint8_t coef = _gf_div(discrepancy, prev_discrepancy);
+		memcpy(temp, locator, sizeof(temp));
+
+		for (size_t i = 0; (i + shift) <= FEC_PARITY_LEN; i++)
+		{
+			locator[i + shift] ^= _gf_mul(coef, prev[i]);
+		}
+
+		if ((2 * degree) <= n)
+		{
+			degree = n + 1 - degree;
+			memcpy(prev, temp, sizeof(prev));
+			prev_discrepancy = discrepancy;
+			shift = 1;
+		}
+		else
+		{
+			shift++;
+		}
+	}
+
+	return degree;
+}
+
+// returns number of corrected bytes, -1 if codeword is not correctable
+static int _decode_block(uint8_t *codeword, size_t len)
+{
+	uint8_t syndromes[FEC_PARITY_LEN];
+	uint8_t locator[FEC_PARITY_LEN + 1];
+	uint8_t evaluator[FEC_PARITY_LEN] = {0};
+	uint8_t derivative[FEC_PARITY_LEN] = {0};
+	size_t positions[MAX_ERRORS];
+	size_t found = 0;
+
+	if (!_calc_syndromes(codeword, len, syndromes))
+	{
+		return 0;
+	}
+
+	size_t degree = _find_error_locator(syndromes, locator);
+	if ((degree == 0) || (degree > MAX_ERRORS))
+	{
+		return -1;
+	}
+
+	// Chien search, byte at index i is coefficient of x^(len - 1 - i)
+	for (size_t i = 0; i < len; i++)
+	{
+		size_t power = len - 1 - i;
+		if (_poly_eval(locator, degree, _gf_pow_a(GF_ORDER - power)) == 0)
+		{
+			if (found == degree)
+			{
+				return -1;
+			}
+			positions[found++] = i;
+		}
+	}
+
+	if (found != degree)
+	{
+		return -1;
+	}
+
+	// error evaluator = syndromes * locator mod x^FEC_PARITY_LEN
+	for (size_t k = 0; k < FEC_PARITY_LEN; k++)
+	{
+		for (size_t i = 0; (i <= degree) && (i <= k); i++)
+		{
+			evaluator[k] ^= _gf_mul(locator[i], syndromes[k - i]);
+		}
+	}
+
+	// formal derivative keeps odd powers only
+	for (size_t i = 1; i <= degree; i += 2)
+	{
+		derivative[i - 1] = locator[i];
+	}
+
+	// Forney algorithm
+	for (size_t e = 0; e < found; e++)
+	{
+		size_t power = len - 1 - positions[e];
+		uint8_t x_inv = _gf_pow_a(GF_ORDER - power);
+		uint8_t denominator = _poly_eval(derivative, degree - 1, x_inv);
+
+		if (denominator == 0)
+		{
+			return -1;
+		}
+
+		uint8_t numerator = _gf_mul(_poly_eval(evaluator, FEC_PARITY_LEN - 1, x_inv), _gf_pow_a(power));
+		codeword[positions[e]] ^= _gf_div(numerator, denominator);
+	}
+
+	return (int) found;
+}
+
+bool fvc_fec_decode(uint8_t *data, size_t data_len, struct fvc_fec_stats *stats)
+{
+	bool status = true;
+
+	if (!gf_tables_ready)
+	{
+		_init_tables();
+	}
+
+	while (data_len > FEC_PARITY_LEN)
+	{
+		size_t block_len = (data_len > FEC_BLOCK_LEN) ? FEC_BLOCK_LEN : data_len;
+		int corrected = _decode_block(data, block_len);
+
+		stats->blocks++;
+		if (corrected < 0)
+		{
+			stats->failed++;
+			status = false;
+		}
+		else
+		{
+			stats->corrected += (uint32_t) corrected;
+		}
+
+		data += block_len;
+		data_len -= block_len;
+	}
+
+	return status && (data_len == 0);
+}
+
+size_t fvc_fec_strip(uint8_t *data, size_t data_len)
+{
+	size_t out_len = 0;
+	size_t in_pos = 0;
+
+	if (fvc_fec_data_len(data_len) == 0)
+	{
+		return 0;
+	}
+
+	while (in_pos < data_len)
+	{
+		size_t block_len = ((data_len - in_pos) > FEC_BLOCK_LEN) ? FEC_BLOCK_LEN : (data_len - in_pos);
+
+		memmove(&data[out_len], &data[in_pos], block_len - FEC_PARITY_LEN);
+		out_len += block_len - FEC_PARITY_LEN;
+		in_pos += block_len;
+	}
+
+	return out_len;
+}
+
+size_t fvc_fec_data_len(size_t encoded_len)
+{
+	size_t remainder = encoded_len % FEC_BLOCK_LEN;
+
+	// shortened codeword has to carry at least one data byte
+	if ((remainder != 0) && (remainder <= FEC_PARITY_LEN))
+	{
+		return 0;
+	}
+
+	return (encoded_len / FEC_BLOCK_LEN) * FEC_BLOCK_DATA_LEN + (remainder ? (remainder - FEC_PARITY_LEN) : 0);
+}
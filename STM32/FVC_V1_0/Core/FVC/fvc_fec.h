@@ -0,0 +1,50 @@
+#ifndef FVC_FEC_H
+#define FVC_FEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Reed-Solomon code over GF(2^8), primitive polynomial 0x11D, generator roots a^0 .. a^(FEC_PARITY_LEN-1)
+ *  payload is split into codewords of FEC_BLOCK_LEN bytes: data (FEC_BLOCK_DATA_LEN B), parity (FEC_PARITY_LEN B)
+ *  last codeword is shortened, it carries remaining data followed by full parity
+ *  each codeword corrects up to FEC_PARITY_LEN / 2 corrupted bytes
+ */
+#define FEC_BLOCK_LEN			255
+#define FEC_PARITY_LEN			16
+#define FEC_BLOCK_DATA_LEN		(FEC_BLOCK_LEN - FEC_PARITY_LEN)
+#define FEC_ENCODED_LEN(_len)	((_len) + FEC_PARITY_LEN * (((_len) + FEC_BLOCK_DATA_LEN - 1) / FEC_BLOCK_DATA_LEN))
+
+struct fvc_fec_stats
+{
+	uint32_t blocks;
+	uint32_t corrected;		// bytes
+	uint32_t failed;		// blocks with too many errors
+};
+
+/**
+ * @brief Corrects encoded payload in place
+ * @param [in] data - encoded payload
+ * @param [in] data_len - length of encoded payload
+ * @param [out] stats - correction counters, updated
+ * @return false if any codeword could not be corrected
+ */
+bool fvc_fec_decode(uint8_t *data, size_t data_len, struct fvc_fec_stats *stats);
+
+/**
+ * @brief Removes parity bytes from decoded payload
+ * @param [in] data - decoded payload, data is compacted in place
+ * @param [in] data_len - length of encoded payload
+ * @return length of data without parity, 0 if payload length is invalid
+ */
+size_t fvc_fec_strip(uint8_t *data, size_t data_len);
+
+/**
+ * @brief Calculates how many data bytes fit into encoded payload
+ * @param [in] encoded_len - length of encoded payload
+ * @return length of data
+ */
+size_t fvc_fec_data_len(size_t encoded_len);
+
+#endif
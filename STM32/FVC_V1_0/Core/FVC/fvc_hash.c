@@ -161,6 +161,25 @@ void fvc_calc_hmac_sha256_write_data(uint8_t *data, size_t data_len)
   sha_256_write(&_sha_struct, (void*) data, data_len);
 }
 
+bool fvc_calc_hmac_sha256_get_state(uint32_t *state)
+{
+  if (_sha_struct.space_left != SIZE_OF_SHA_256_CHUNK)
+  {
+    return false;
+  }
+
+  memcpy(state, _sha_struct.h, sizeof(_sha_struct.h));
+  return true;
+}
+
+void fvc_calc_hmac_sha256_set_state(uint8_t *key, size_t key_len, uint32_t *state, size_t data_len)
+{
+  fvc_calc_hmac_sha256_init(key, key_len);
+
+  memcpy(_sha_struct.h, state, sizeof(_sha_struct.h));
+  _sha_struct.total_len += data_len;
+}
+
 void fvc_calc_hmac_sha256_end_calc(uint8_t *hash_out)
 {
   sha_256_close(&_sha_struct);
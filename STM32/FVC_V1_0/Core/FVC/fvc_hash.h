@@ -48,4 +48,22 @@ void fvc_calc_hmac_sha256_write_data(uint8_t *data, size_t data_len);
  */
 void fvc_calc_hmac_sha256_end_calc(uint8_t *hash_out);
 
+/**
+ * @brief Exports midstate of streamed HMAC-SHA256 calculation
+ * @param [out] state - inner hash state (8 words)
+ * @return false if data written so far does not end on 64 byte boundary
+ * @note this functions set can only be used on streamed data
+ */
+bool fvc_calc_hmac_sha256_get_state(uint32_t *state);
+
+/**
+ * @brief Continues streamed HMAC-SHA256 calculation from exported midstate
+ * @param [in] key - pointer to key
+ * @param [in] key_len - length of key
+ * @param [in] state - inner hash state (8 words)
+ * @param [in] data_len - length of data hashed before state was exported
+ * @note this functions set can only be used on streamed data
+ */
+void fvc_calc_hmac_sha256_set_state(uint8_t *key, size_t key_len, uint32_t *state, size_t data_len);
+
 #endif
@@ -0,0 +1,141 @@
+#include "fvc_log.h"
+#include "fvc_protocol.h"
+#include "fvc_queue.h"
+#include "bsp.h"
+
+extern const char __fvc_log_fmt_start[];	// linker script
+
+struct fvc_log_ctx
+{
+	bool enabled;
+	bool deferred;
+	volatile uint32_t dropped;		// records lost since last TYPE_LOG_DATA frame
+};
+
+static struct fvc_log_ctx ctx;
+
+FVC_QUEUE_DEFINE(log_queue, struct fvc_log_record, LOG_QUEUE_LEN);
+
+static inline size_t _encode_be(uint8_t *data, uint32_t value, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		data[i] = (uint8_t) (value >> (8 * (len - 1 - i)));
+	}
+	return len;
+}
+
+static void _log_transmit(const char *fmt, const uint32_t *args, size_t nargs)
+{
+	uint32_t a[LOG_MAX_ARGS] = {0};
+
+	for (size_t i = 0; i < nargs; i++)
+	{
+		a[i] = args[i];
+	}
+	debug_transmit(fmt, a[0], a[1], a[2], a[3]);
+}
+
+void fvc_log_init(uint8_t debug_conf, bool deferred)
+{
+	ctx.enabled = (debug_conf != 0);
+	ctx.deferred = deferred;
+}
+
+bool fvc_log_is_enabled(void)
+{
+	return ctx.enabled;
+}
+
+void fvc_log_write(const char *fmt, const uint32_t *args, size_t nargs)
+{
+	if (!ctx.enabled)
+	{
+		return;
+	}
+
+	// debug_transmit waits for TX slot, records from ISR are formatted later by fvc_log_flush
+	if (!ctx.deferred && (__get_IPSR() == 0))
+	{
+		_log_transmit(fmt, args, nargs);
+		return;
+	}
+
+	// ISRs may log too, ring has single producer only inside critical section
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	struct fvc_log_record *record = fvc_queue_reserve(&log_queue);
+	if (record == NULL)
+	{
+		ctx.dropped++;
+	}
+	else
+	{
+		record->tick = HAL_GetTick();
+		record->fmt_id = (uint16_t) (fmt - __fvc_log_fmt_start);
+		record->nargs = (uint8_t) nargs;
+		for (size_t i = 0; i < nargs; i++)
+		{
+			record->args[i] = args[i];
+		}
+		fvc_queue_commit(&log_queue);
+	}
+
+	__set_PRIMASK(primask);
+}
+
+void fvc_log_flush(void)
+{
+	uint8_t payload[LOG_DATA_MAX_LEN];
+	struct fvc_log_record *record;
+
+	if (!ctx.deferred)
+	{
+		while ((record = fvc_queue_peek(&log_queue)) != NULL)
+		{
+			_log_transmit(&__fvc_log_fmt_start[record->fmt_id], record->args, record->nargs);
+			fvc_queue_release(&log_queue);
+		}
+		return;
+	}
+
+	while ((fvc_queue_peek(&log_queue) != NULL) || (ctx.dropped > 0))
+	{
+		__disable_irq();
+		uint32_t dropped = ctx.dropped;
+		ctx.dropped = 0;
+		__enable_irq();
+
+		size_t len = _encode_be(payload, dropped, 4);
+		uint32_t count = 0;
+
+		// records stay queued until frame is accepted, failed send is retried on next flush
+		while (((record = fvc_queue_peek_at(&log_queue, count)) != NULL)
+				&& ((len + LOG_RECORD_HEADER_LEN + 4 * record->nargs) <= sizeof(payload)))
+		{
+			len += _encode_be(&payload[len], record->tick, 4);
+			len += _encode_be(&payload[len], record->fmt_id, 2);
+			len += _encode_be(&payload[len], record->nargs, 1);
+			for (size_t i = 0; i < record->nargs; i++)
+			{
+				len += _encode_be(&payload[len], record->args[i], 4);
+			}
+			count++;
+		}
+
+		if (!send_frame(TYPE_LOG_DATA, payload, len))
+		{
+			// host learns about lost records from next frame
+			__disable_irq();
+			ctx.dropped += dropped;
+			__enable_irq();
+			return;
+		}
+
+		while (count-- > 0)
+		{
+			fvc_queue_release(&log_queue);
+		}
+	}
+}
@@ -0,0 +1,127 @@
+#ifndef FVC_LOG_H
+#define FVC_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "fvc.h"
+
+#define LOG_MAX_ARGS			4
+#define LOG_QUEUE_LEN			64		// records, power of two
+
+/*
+ * Deferred logging
+ *  FVC_LOG stores format string in .fvc_log_fmt section (kept in ELF, see linker script),
+ *  call site only writes record with string offset, tick and raw arguments into RAM ring
+ *  records are sent as TYPE_LOG_DATA frames, host formats them with strings read from ELF
+ *  arguments are passed as 32-bit integers, %s and floating point are not supported
+ *  when deferred mode is disabled record is formatted immediately by debug_transmit,
+ *  records logged from ISR are still queued and formatted by fvc_log_flush
+ */
+#define FVC_LOG(_fmt, ...) \
+	do { \
+		static const char _log_fmt[] __attribute__((section(".fvc_log_fmt"))) = _fmt; \
+		const uint32_t _log_args[] = {0, ##__VA_ARGS__}; \
+		_Static_assert(sizeof(_log_args) <= ((LOG_MAX_ARGS + 1) * sizeof(uint32_t)), "too many log arguments"); \
+		fvc_log_write(_log_fmt, &_log_args[1], (sizeof(_log_args) / sizeof(uint32_t)) - 1); \
+	} while (0)
+
+// severities, CFG_LOG_LEVEL in fvc.h selects the lowest one compiled in
+#define LOG_LEVEL_NONE			0
+#define LOG_LEVEL_ERROR			1
+#define LOG_LEVEL_WARN			2
+#define LOG_LEVEL_INFO			3
+#define LOG_LEVEL_DEBUG			4
+#define LOG_LEVEL_TRACE			5		// hot loops
+
+// modules, CFG_LOG_MODULES in fvc.h masks them
+#define LOG_MODULE_CORE			(1 << 0)	// startup, update flow
+#define LOG_MODULE_PROTOCOL		(1 << 1)
+#define LOG_MODULE_W25Q			(1 << 2)
+#define LOG_MODULE_BOOTLOADER	(1 << 3)
+#define LOG_MODULE_SUPERVISOR	(1 << 4)
+#define LOG_MODULE_BACKUP		(1 << 5)
+#define LOG_MODULE_ALL			0x3F
+
+/*
+ * Filtered logging, LOG_<LEVEL>(module, format, args...)
+ *  levels above CFG_LOG_LEVEL expand to nothing, arguments are not evaluated
+ *  masked modules give constant false condition and are removed by compiler
+ *  runtime check (any debug output configured) is done before record is built
+ */
+#define LOG_WRITE(_module, _fmt, ...) \
+	do { \
+		if (((CFG_LOG_MODULES & (_module)) != 0) && fvc_log_is_enabled()) { \
+			FVC_LOG(_fmt, ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+// arguments are only type checked (sizeof does not evaluate them), no code or string is emitted
+#define LOG_DISCARD(_module, _fmt, ...)	((void) sizeof((const uint32_t[]) {0, ##__VA_ARGS__}))
+
+#if CFG_LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR	LOG_WRITE
+#else
+#define LOG_ERROR	LOG_DISCARD
+#endif
+
+#if CFG_LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN	LOG_WRITE
+#else
+#define LOG_WARN	LOG_DISCARD
+#endif
+
+#if CFG_LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO	LOG_WRITE
+#else
+#define LOG_INFO	LOG_DISCARD
+#endif
+
+#if CFG_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG	LOG_WRITE
+#else
+#define LOG_DEBUG	LOG_DISCARD
+#endif
+
+#if CFG_LOG_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE	LOG_WRITE
+#else
+#define LOG_TRACE	LOG_DISCARD
+#endif
+
+struct fvc_log_record
+{
+	uint32_t tick;				// ms
+	uint16_t fmt_id;			// offset of format string in .fvc_log_fmt section
+	uint8_t nargs;
+	uint32_t args[LOG_MAX_ARGS];
+};
+
+/**
+ * @brief Selects logging mode
+ * @param [in] debug_conf - debug outputs configured in EEPROM, logging is off when none is
+ * @param [in] deferred - true: records are queued and sent as TYPE_LOG_DATA, false: formatted on board
+ */
+void fvc_log_init(uint8_t debug_conf, bool deferred);
+
+/**
+ * @brief Checks if any debug output is configured
+ * @return false if log records would be discarded
+ */
+bool fvc_log_is_enabled(void);
+
+/**
+ * @brief Stores log record, called by FVC_LOG, can be called from ISR in both modes
+ * @param [in] fmt - format string placed in .fvc_log_fmt section
+ * @param [in] args - arguments
+ * @param [in] nargs - number of arguments, at most LOG_MAX_ARGS
+ */
+void fvc_log_write(const char *fmt, const uint32_t *args, size_t nargs);
+
+/**
+ * @brief Sends queued records in TYPE_LOG_DATA frames (formatted if not deferred), thread only
+ */
+void fvc_log_flush(void);
+
+#endif
@@ -0,0 +1,130 @@
+#include "fvc_lz.h"
+
+#define WINDOW_MASK		(LZ_WINDOW_SIZE - 1)
+
+static bool _flush(struct fvc_lz *lz)
+{
+	bool status = true;
+
+	if (lz->window_pos != lz->flush_pos)
+	{
+		status = lz->output(&lz->window[lz->flush_pos], lz->window_pos - lz->flush_pos);
+	}
+
+	lz->flush_pos = lz->window_pos;
+	return status;
+}
+
+static bool _put_byte(struct fvc_lz *lz, uint8_t byte)
+{
+	lz->window[lz->window_pos++] = byte;
+
+	if (lz->window_fill < LZ_WINDOW_SIZE)
+	{
+		lz->window_fill++;
+	}
+
+	// window wraps, pass decompressed data before it is overwritten
+	if (lz->window_pos == LZ_WINDOW_SIZE)
+	{
+		bool status = _flush(lz);
+		lz->window_pos = 0;
+		lz->flush_pos = 0;
+		return status;
+	}
+	return true;
+}
+
+static bool _copy_match(struct fvc_lz *lz, uint8_t match_lo)
+{
+	uint32_t distance = ((((uint32_t) lz->match_hi) << 4) | (match_lo >> 4)) + 1;
+	uint32_t len = (match_lo & 0x0F) + LZ_MIN_MATCH;
+
+	if (distance > lz->window_fill)
+	{
+		return false;
+	}
+
+	uint16_t src = (lz->window_pos - distance) & WINDOW_MASK;
+	while (len--)
+	{
+		if (!_put_byte(lz, lz->window[src]))
+		{
+			return false;
+		}
+		src = (src + 1) & WINDOW_MASK;
+	}
+	return true;
+}
+
+void fvc_lz_init(struct fvc_lz *lz, lz_output_t output)
+{
+	lz->state = LZ_STATE_FLAGS;
+	lz->flags = 0;
+	lz->flags_left = 0;
+	lz->match_hi = 0;
+
+	lz->window_pos = 0;
+	lz->flush_pos = 0;
+	lz->window_fill = 0;
+	lz->output = output;
+}
+
+bool fvc_lz_write(struct fvc_lz *lz, uint8_t *data, size_t data_len)
+{
+	bool status = true;
+
+	for (size_t i = 0; (i < data_len) && status; i++)
+	{
+		uint8_t byte = data[i];
+
+		switch (lz->state) {
+			case LZ_STATE_FLAGS:
+				lz->flags = byte;
+				lz->flags_left = 8;
+				lz->state = LZ_STATE_ITEM;
+				break;
+			case LZ_STATE_ITEM:
+				if (lz->flags & 0x01)
+				{
+					status = _put_byte(lz, byte);
+				}
+				else
+				{
+					lz->match_hi = byte;
+					lz->state = LZ_STATE_MATCH;
+					break;
+				}
+
+				lz->flags >>= 1;
+				lz->state = (--lz->flags_left > 0) ? LZ_STATE_ITEM : LZ_STATE_FLAGS;
+				break;
+			case LZ_STATE_MATCH:
+				status = _copy_match(lz, byte);
+
+				lz->flags >>= 1;
+				lz->state = (--lz->flags_left > 0) ? LZ_STATE_ITEM : LZ_STATE_FLAGS;
+				break;
+			default:
+				status = false;
+				break;
+		}
+	}
+
+	if (status)
+	{
+		status = _flush(lz);
+	}
+
+	if (!status)
+	{
+		lz->state = LZ_STATE_ERROR;
+	}
+	return status;
+}
+
+bool fvc_lz_finish(struct fvc_lz *lz)
+{
+	// unused flag bits after last item are allowed
+	return (lz->state == LZ_STATE_FLAGS) || (lz->state == LZ_STATE_ITEM);
+}
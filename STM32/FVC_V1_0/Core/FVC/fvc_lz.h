@@ -0,0 +1,68 @@
+#ifndef FVC_LZ_H
+#define FVC_LZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * LZSS stream format:
+ *  flags byte, bits consumed from LSB, followed by 8 items
+ *   bit = 1 - literal byte
+ *   bit = 0 - match, 2 bytes big endian: distance - 1 (12 bits), length - LZ_MIN_MATCH (4 bits)
+ */
+#define LZ_WINDOW_SIZE		4096
+#define LZ_MIN_MATCH		3
+#define LZ_MAX_MATCH		(LZ_MIN_MATCH + 15)
+
+typedef bool (*lz_output_t)(uint8_t *data, size_t data_len);
+
+enum lz_state
+{
+	LZ_STATE_FLAGS = 0,
+	LZ_STATE_ITEM,
+	LZ_STATE_MATCH,
+	LZ_STATE_ERROR,
+
+	LZ_STATE_TOP
+};
+
+struct fvc_lz
+{
+	enum lz_state state;
+	uint8_t flags;
+	uint8_t flags_left;
+	uint8_t match_hi;
+
+	uint16_t window_pos;
+	uint16_t flush_pos;
+	uint32_t window_fill;
+	lz_output_t output;
+
+	uint8_t window[LZ_WINDOW_SIZE];
+};
+
+/**
+ * @brief Initialize streaming decompressor
+ * @param [in] lz - decompressor context
+ * @param [in] output - sink for decompressed data
+ */
+void fvc_lz_init(struct fvc_lz *lz, lz_output_t output);
+
+/**
+ * @brief Decompresses next part of stream, items may span between calls
+ * @param [in] lz - decompressor context
+ * @param [in] data - compressed data
+ * @param [in] data_len - length of compressed data
+ * @return false if stream is malformed or output failed
+ */
+bool fvc_lz_write(struct fvc_lz *lz, uint8_t *data, size_t data_len);
+
+/**
+ * @brief Checks if compressed stream ended on item boundary
+ * @param [in] lz - decompressor context
+ * @return true if whole stream was decompressed
+ */
+bool fvc_lz_finish(struct fvc_lz *lz);
+
+#endif
@@ -1,5 +1,6 @@
 #include "fvc_protocol.h"
 #include "fvc.h"
+#include "fvc_queue.h"
 #include "bsp.h"
 
 #include <string.h>
@@ -7,23 +8,54 @@
 #define IS_PROTOCOL_DEBUG_ENABLED(_debug_config) (_debug_config & (1 << 0)) ? true : false
 #define IS_INTERFACE_DEBUG_ENABLED(_debug_config) (_debug_config & (1 << 1)) ? true : false
 
+#define MAX_CLI_MSG			256
+
+#define SFD_VALUE			0xAB
+
+#define PACKET_CONST_LEN	7			// SFD (1B), PACKET_LEN (2B), SRC_ID (1B), DST_ID (1B), DATA_TYPE (1B), CRC (1B)
+#define MAX_PAYLOAD_LEN 	(65536 - PACKET_CONST_LEN)	// max value of data len to fit in uint16_t variable
+
+#define INTERFACE_TX_SLOTS	4
+#define DEBUG_TX_SLOTS		8
+#define TX_SLOT_WAIT_MS		100			// bound of former blocking transmission
+
+/*
+ * Outgoing data is serialized directly into queue slots by thread, DMA sends
+ * slots in order and completion interrupt chains next one. Responses wait for
+ * free slot, debug output is dropped and counted instead.
+ */
+struct tx_slot
+{
+	uint16_t len;
+	uint8_t data[MAX_CLI_MSG + PACKET_CONST_LEN];
+};
+
+struct tx_channel
+{
+	struct fvc_queue *queue;
+	bool (*transmit)(uint8_t *data, size_t data_len);
+	bool framed;				// debug text is wrapped into TYPE_CLI_DATA frame
+	volatile bool active;		// oldest slot is being sent
+	volatile uint32_t errors;
+	uint32_t dropped;			// debug messages not queued since last notice
+};
+
 struct fvc_protocol_ctx
 {
 	// values read from EEPROM
 	uint8_t debug_conf;
 	uint8_t board_id;
+
+	uint8_t debug_text[MAX_CLI_MSG];
 };
 
 static struct fvc_protocol_ctx ctx;
 
-#define MAX_CLI_MSG			256
-
-#define SFD_VALUE			0xAB
-
-#define PACKET_CONST_LEN	7			// SFD (1B), PACKET_LEN (2B), SRC_ID (1B), DST_ID (1B), DATA_TYPE (1B), CRC (1B)
-#define MAX_PAYLOAD_LEN 	(65536 - PACKET_CONST_LEN)	// max value of data len to fit in uint16_t variable
+FVC_QUEUE_DEFINE(interface_tx_queue, struct tx_slot, INTERFACE_TX_SLOTS);
+FVC_QUEUE_DEFINE(debug_tx_queue, struct tx_slot, DEBUG_TX_SLOTS);
 
-#define PROTOCOL_VERSION	2
+static struct tx_channel interface_tx = {.queue = &interface_tx_queue, .transmit = bsp_interface_transmit_DMA, .framed = true};
+static struct tx_channel debug_tx = {.queue = &debug_tx_queue, .transmit = bsp_debug_interface_transmit_DMA, .framed = false};
 
 /**
  * Table with calculated crc table.
@@ -65,59 +97,225 @@ static uint8_t _calculate_hash(uint8_t *data, size_t data_len)
 	return crc;
 }
 
-void fvc_protocol_init(uint8_t board_id, uint8_t debug_conf)
+// consumer side, runs in completion interrupt or with interrupts disabled
+static void _tx_start(struct tx_channel *channel)
 {
-	ctx.board_id = board_id;
-	ctx.debug_conf = debug_conf;
+	struct tx_slot *slot;
+
+	while (!channel->active && ((slot = fvc_queue_peek(channel->queue)) != NULL))
+	{
+		if (channel->transmit(slot->data, slot->len))
+		{
+			channel->active = true;
+		}
+		else
+		{
+			channel->errors++;
+			fvc_queue_release(channel->queue);
+		}
+	}
 }
 
-bool debug_transmit(const char* format, ...)
+static void _tx_complete(struct tx_channel *channel, bool ok)
+{
+	if (!ok)
+	{
+		channel->errors++;
+	}
+
+	fvc_queue_release(channel->queue);
+	channel->active = false;
+	_tx_start(channel);
+}
+
+static void _interface_tx_callback(bool ok)
+{
+	_tx_complete(&interface_tx, ok);
+}
+
+static void _debug_tx_callback(bool ok)
+{
+	_tx_complete(&debug_tx, ok);
+}
+
+static struct tx_slot *_tx_reserve(struct tx_channel *channel, uint32_t timeout)
 {
+	uint32_t start_tick = HAL_GetTick();
+	struct tx_slot *slot;
+
+	while ((slot = fvc_queue_reserve(channel->queue)) == NULL)
+	{
+		if ((HAL_GetTick() - start_tick) >= timeout)
+		{
+			return NULL;
+		}
+	}
+	return slot;
+}
 
-	bool status = false;
-	uint8_t temp_buff[MAX_CLI_MSG] = {0};
-	uint8_t serialized_packet[MAX_CLI_MSG + PACKET_CONST_LEN] = {0};
+static void _tx_commit(struct tx_channel *channel, struct tx_slot *slot, size_t len)
+{
+	slot->len = (uint16_t) len;
+	fvc_queue_commit(channel->queue);
+
+	// callers may already run with interrupts disabled
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	_tx_start(channel);
+	__set_PRIMASK(primask);
+}
+
+static size_t _debug_fill(struct tx_channel *channel, struct tx_slot *slot, uint8_t *text, size_t text_len)
+{
 	struct protocol_frame frame = {
 			.source_id = ctx.board_id,
 			.destination_id = 0,
 			.data_type = TYPE_CLI_DATA,
-			.payload_ptr = temp_buff
+			.payload_len = text_len,
+			.payload_ptr = text
 	};
+
+	if (!channel->framed)
+	{
+		memcpy(slot->data, text, text_len);
+		return text_len;
+	}
+	return frame_serialize(&frame, slot->data, sizeof(slot->data));
+}
+
+// never waits for slot, messages dropped meanwhile are reported once slot is free
+static bool _debug_enqueue(struct tx_channel *channel, uint8_t *text, size_t text_len)
+{
+	struct tx_slot *slot = fvc_queue_reserve(channel->queue);
+	size_t len;
+
+	if ((slot != NULL) && (channel->dropped > 0))
+	{
+		uint8_t notice[40];
+		size_t notice_len = snprintf((char *)notice, sizeof(notice), "[%lu debug messages dropped]\n\r", (unsigned long) channel->dropped);
+
+		len = _debug_fill(channel, slot, notice, notice_len);
+		if (len > 0)
+		{
+			_tx_commit(channel, slot, len);
+			channel->dropped = 0;
+		}
+		slot = fvc_queue_reserve(channel->queue);
+	}
+
+	if (slot == NULL)
+	{
+		channel->dropped++;
+		return false;
+	}
+
+	len = _debug_fill(channel, slot, text, text_len);
+	if (len == 0)
+	{
+		return false;
+	}
+
+	_tx_commit(channel, slot, len);
+	return true;
+}
+
+void fvc_protocol_init(uint8_t board_id, uint8_t debug_conf)
+{
+	ctx.board_id = board_id;
+	ctx.debug_conf = debug_conf;
+
+	bsp_interface_tx_init(_interface_tx_callback);
+	bsp_debug_interface_tx_init(_debug_tx_callback);
+}
+
+bool debug_transmit(const char* format, ...)
+{
+	bool status = true;
 	va_list ap;
+
+	if (!(IS_INTERFACE_DEBUG_ENABLED(ctx.debug_conf)) && !(IS_PROTOCOL_DEBUG_ENABLED(ctx.debug_conf)))
+	{
+		return false;
+	}
+
 	va_start(ap, format);
-	size_t len = vsnprintf((char*)temp_buff, MAX_CLI_MSG, (const char*)format, ap);\
-	if(len == 0)
-		return status;
+	int len = vsnprintf((char*)ctx.debug_text, MAX_CLI_MSG, (const char*)format, ap);
+	va_end(ap);
+
+	if (len <= 0)
+	{
+		return false;
+	}
+	if (len >= MAX_CLI_MSG)
+	{
+		len = MAX_CLI_MSG - 1;		// truncated
+	}
 
 	if (IS_INTERFACE_DEBUG_ENABLED(ctx.debug_conf))
-		status = bsp_debug_interface_transmit((uint8_t *)temp_buff, len);
+	{
+		status &= _debug_enqueue(&debug_tx, ctx.debug_text, (size_t) len);
+	}
 
 	if (IS_PROTOCOL_DEBUG_ENABLED(ctx.debug_conf))
 	{
-		frame.payload_len = len;
-		len = frame_serialize(&frame,(uint8_t *) serialized_packet, MAX_CLI_MSG + PACKET_CONST_LEN);
-		status &= bsp_interface_transmit((uint8_t *)serialized_packet, len);
+		status &= _debug_enqueue(&interface_tx, ctx.debug_text, (size_t) len);
 	}
 
-	va_end(ap);
 	return status;
 }
 
 bool send_response(enum payload_type response)
 {
-	bool status = false;
-	uint8_t serialized_packet[MAX_CLI_MSG + PACKET_CONST_LEN] = {0};
+	return send_frame(response, NULL, 0);
+}
+
+bool send_frame(enum payload_type type, uint8_t *payload, size_t payload_len)
+{
 	struct protocol_frame frame = {
 			.source_id = ctx.board_id,
 			.destination_id = 0,
+			.data_type = type,
+			.payload_len = payload_len,
+			.payload_ptr = payload
 	};
-	frame.data_type = response;
+	struct tx_slot *slot = _tx_reserve(&interface_tx, TX_SLOT_WAIT_MS);
 
-	size_t len = frame_serialize(&frame,(uint8_t *) serialized_packet, MAX_CLI_MSG + PACKET_CONST_LEN);
-	if (len > 0) {
-		status = bsp_interface_transmit((uint8_t *)serialized_packet, len);
+	if (slot == NULL)
+	{
+		return false;
 	}
-	return status;
+
+	size_t len = frame_serialize(&frame, slot->data, sizeof(slot->data));
+	if (len == 0)
+	{
+		return false;
+	}
+
+	_tx_commit(&interface_tx, slot, len);
+	return true;
+}
+
+bool flush_transmit(uint32_t timeout)
+{
+	uint32_t start_tick = HAL_GetTick();
+
+	while (interface_tx.active)
+	{
+		if ((HAL_GetTick() - start_tick) >= timeout)
+		{
+			uint32_t primask = __get_PRIMASK();
+			__disable_irq();
+			bsp_interface_abort_transmit();
+			interface_tx.active = false;
+			while (fvc_queue_peek(interface_tx.queue) != NULL)
+			{
+				fvc_queue_release(interface_tx.queue);
+			}
+			__set_PRIMASK(primask);
+			return false;
+		}
+	}
+	return true;
 }
 
 #if PROTOCOL_VERSION == 1
@@ -236,13 +434,24 @@ static size_t _calculate_packet_len(struct protocol_frame * structure)
 	size_t packet_len = PACKET_CONST_LEN;
 
 	switch (structure->data_type) {
+		case TYPE_NACK:
+		case TYPE_ACK:
+		case TYPE_ID_RESP:
 		case TYPE_CLI_DATA:
 		case TYPE_PROGRAM_DATA:
+		case TYPE_PROGRAM_MULTICAST_STATUS:
+		case TYPE_LINK_STATUS:
+		case TYPE_SCRUB_STATUS:
+		case TYPE_SUPERVISION_STATS:
 			packet_len += (structure->payload_len);
 
 		case TYPE_PROGRAM_UPDATE_REQUEST:
 			packet_len += 12;
 			break;
+		// batched up to LOG_DATA_MAX_LEN, exact length has to fit TX slot
+		case TYPE_LOG_DATA:
+			packet_len += (structure->payload_len);
+			break;
 		default:
 			break;
 	}
@@ -267,9 +476,16 @@ size_t frame_serialize (struct protocol_frame * structure, uint8_t * packet, siz
 	packet[5] = (uint8_t) structure->data_type;
 
 	switch (structure->data_type) {
+		case TYPE_NACK:
+		case TYPE_ACK:
 		case TYPE_ID_RESP:
 		case TYPE_PROGRAM_DATA:
 		case TYPE_CLI_DATA:
+		case TYPE_PROGRAM_MULTICAST_STATUS:
+		case TYPE_LINK_STATUS:
+		case TYPE_SCRUB_STATUS:
+		case TYPE_SUPERVISION_STATS:
+		case TYPE_LOG_DATA:
 			memcpy(&packet[iterator], structure->payload_ptr, structure->payload_len);
 			iterator += structure->payload_len;
 			break;
@@ -291,6 +507,11 @@ bool frame_deserialize (struct protocol_frame * structure, uint8_t * packet, siz
 	size_t packet_len = ((((uint16_t) packet[1]) << 8) | ((uint16_t) packet[2]));
 	uint8_t calculated_hash = 0;
 
+	// length is not protected until CRC is checked, payload is copied before that
+	if ((packet_len < PACKET_CONST_LEN) || (packet_len > max_packet_len)) {
+		return false;
+	}
+
 	structure->payload_len = packet_len - PACKET_CONST_LEN;
 
 	structure->source_id = packet[3];
@@ -302,6 +523,11 @@ bool frame_deserialize (struct protocol_frame * structure, uint8_t * packet, siz
 		case TYPE_PROGRAM_UPDATE_REQUEST:
 		case TYPE_PROGRAM_DATA:
 		case TYPE_CLI_DATA:
+		case TYPE_PROGRAM_MULTICAST_DATA:
+		case TYPE_PROGRAM_MULTICAST_STATUS:
+		case TYPE_BAUD_SWITCH_REQUEST:
+		case TYPE_SCRUB_REQUEST:
+		case TYPE_SUPERVISION_STATS_REQUEST:
 			memcpy(structure->payload_ptr, &packet[6], structure->payload_len);
 			break;
 		default:
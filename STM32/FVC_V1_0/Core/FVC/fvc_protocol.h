@@ -7,6 +7,8 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#define PROTOCOL_VERSION		2
+
 #define PROTOCOL_COMMON_LEN		3		// Common data in frame (source_id, destination_id, data_type)
 #define PROTOCOL_HASH_LEN		2
 #define PROTOCOL_MAX_DATA_LEN	16*1024
@@ -25,10 +27,88 @@ enum payload_type
 	TYPE_PROGRAM_UPDATE_FINISHED,
 	TYPE_EEPROM_DATA_READ,
 	TYPE_EEPROM_DATA_WRITE,
+	TYPE_PROGRAM_MULTICAST_DATA,
+	TYPE_PROGRAM_MULTICAST_STATUS,
+	TYPE_PROGRAM_MULTICAST_COMMIT,
+	TYPE_BAUD_SWITCH_REQUEST,
+	TYPE_BAUD_SWITCH_PROBE,
+	TYPE_LINK_STATUS,
+	TYPE_SCRUB_REQUEST,
+	TYPE_SCRUB_STATUS,
+	TYPE_SUPERVISION_STATS_REQUEST,
+	TYPE_SUPERVISION_STATS,
+	TYPE_LOG_DATA,
 
 	TYPE_TOP
 };
 
+// flags of TYPE_PROGRAM_UPDATE_REQUEST
+#define UPDATE_FLAG_DELTA		(1 << 0)	// program data is a patch against current backup
+#define UPDATE_FLAG_COMPRESSED	(1 << 1)	// program data is LZSS compressed (see fvc_lz.h)
+#define UPDATE_FLAG_MULTICAST	(1 << 2)	// join multicast session, data is sent to group ID
+#define UPDATE_FLAG_FEC			(1 << 3)	// TYPE_PROGRAM_DATA payload is Reed-Solomon encoded (see fvc_fec.h)
+#define UPDATE_FLAG_RESUME		(1 << 4)	// continue interrupted transfer of the same image if board has checkpoint
+
+// ACK of TYPE_PROGRAM_UPDATE_REQUEST with UPDATE_FLAG_RESUME: payload offset (4B), frame counter (4B) to continue from
+#define RESUME_ACK_LEN			8
+
+#define PROTOCOL_DST_ID_POS		4		// position of destination ID in serialized frame
+
+/*
+ * TYPE_ID_RESP payload, all values big endian:
+ *  protocol version (1B), firmware version (4B), max program data length (2B),
+ *  frame window size (1B), supported update flags (1B), max baudrate (4B),
+ *  default baudrate (4B), interface capabilities (1B)
+ */
+#define ID_RESP_LEN				18
+
+/*
+ * TYPE_LINK_STATUS payload of last update session, all values big endian:
+ *  received frames (4B), CRC errors (4B), receive timeouts (4B), NACKs (4B),
+ *  recommended frame length (2B), FEC corrected bytes (4B), FEC uncorrectable codewords (4B),
+ *  FEC decoding cycles per codeword (4B)
+ * ACK/NACK of TYPE_PROGRAM_DATA carry recommended frame length (2B) only.
+ */
+#define LINK_STATUS_LEN			30
+
+/*
+ * TYPE_SCRUB_REQUEST payload: flags (1B), SCRUB_FLAG_TARGET starts target verification through bootloader,
+ *  application is stopped until it finishes (maintenance window)
+ * TYPE_SCRUB_STATUS payload, for backup and target region, values big endian:
+ *  result of last pass (1B), boot count (4B), uptime when pass finished [s] (4B)
+ */
+#define SCRUB_FLAG_TARGET		(1 << 0)
+#define SCRUB_STATUS_REGION_LEN	9
+#define SCRUB_STATUS_LEN		(2 * SCRUB_STATUS_REGION_LEN)
+
+/*
+ * TYPE_SUPERVISION_STATS_REQUEST payload: index of first variable (1B), flags (1B)
+ * TYPE_SUPERVISION_STATS payload, all values big endian:
+ *  supervisor state (1B), variable count (1B), refreshes (4B), early refreshes (4B), batch CRC errors (4B),
+ *  supervisee resets (4B), refresh interval min, max, mean, last [us] (4 x 4B),
+ *  interval histogram (SUPERVISION_HISTOGRAM_BUCKETS x 4B, log2 buckets in us),
+ *  index of first variable (1B), number of variables (1B), out-of-range count of each variable (4B)
+ * Host reads out-of-range counters in pages of SUPERVISION_STATS_PAGE_VARS variables.
+ */
+#define SUPERVISION_STATS_FLAG_CLEAR	(1 << 0)	// clear statistics after they are sent
+#define SUPERVISION_STATS_HEADER_LEN	34
+#define SUPERVISION_STATS_PAGE_VARS		16
+
+/*
+ * TYPE_LOG_DATA payload (see fvc_log.h), all values big endian:
+ *  records dropped before this frame (4B), then records:
+ *  tick [ms] (4B), format string offset in .fvc_log_fmt section (2B), number of arguments (1B), arguments (n x 4B)
+ */
+#define LOG_DATA_MAX_LEN		256
+#define LOG_RECORD_HEADER_LEN	7
+
+// interface capabilities of TYPE_ID_RESP
+#define CAPABILITY_ADDRESS_MARK	(1 << 0)	// frames have to be preceded by 9-bit address character
+
+// destination IDs reserved for multicast groups
+#define PROTOCOL_GROUP_ID_MIN	0xF0
+#define PROTOCOL_GROUP_ID_MAX	0xFE
+
 struct protocol_frame
 {
 	uint8_t source_id;
@@ -41,9 +121,13 @@ struct protocol_frame
 void fvc_protocol_init(uint8_t board_id, uint8_t debug_conf);
 
 size_t frame_serialize (struct protocol_frame * structure, uint8_t * packet, size_t max_packet_len);
+// frames longer than max_packet_len are rejected, payload_ptr has to hold max_packet_len - 7 bytes
 bool frame_deserialize (struct protocol_frame * structure, uint8_t * packet, size_t max_packet_len);
 
 bool debug_transmit(const char* format, ...);
 bool send_response(enum payload_type response);
+bool send_frame(enum payload_type type, uint8_t *payload, size_t payload_len);
+// waits until queued frames are sent on interface (timeout in ms), queue is discarded on timeout
+bool flush_transmit(uint32_t timeout);
 
 #endif
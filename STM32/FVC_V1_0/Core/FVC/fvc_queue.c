@@ -0,0 +1,93 @@
+#include "fvc_queue.h"
+#include "bsp.h"
+
+#include <string.h>
+
+static inline uint8_t *_slot(struct fvc_queue *queue, uint32_t index)
+{
+	return &queue->storage[(index & queue->mask) * queue->elem_size];
+}
+
+void *fvc_queue_reserve(struct fvc_queue *queue)
+{
+	uint32_t head = queue->head;
+
+	if ((head - queue->tail) > queue->mask)
+	{
+		return NULL;
+	}
+
+	// slot is not reused before consumer released it
+	__DMB();
+	return _slot(queue, head);
+}
+
+void fvc_queue_commit(struct fvc_queue *queue)
+{
+	// element has to be visible before index is
+	__DMB();
+	queue->head = queue->head + 1;
+}
+
+void *fvc_queue_peek(struct fvc_queue *queue)
+{
+	uint32_t tail = queue->tail;
+
+	if (queue->head == tail)
+	{
+		return NULL;
+	}
+
+	// index has to be read before element is
+	__DMB();
+	return _slot(queue, tail);
+}
+
+void *fvc_queue_peek_at(struct fvc_queue *queue, uint32_t offset)
+{
+	uint32_t tail = queue->tail;
+
+	if ((queue->head - tail) <= offset)
+	{
+		return NULL;
+	}
+
+	// index has to be read before element is
+	__DMB();
+	return _slot(queue, tail + offset);
+}
+
+void fvc_queue_release(struct fvc_queue *queue)
+{
+	// element has to be consumed before slot is given back
+	__DMB();
+	queue->tail = queue->tail + 1;
+}
+
+bool fvc_queue_push(struct fvc_queue *queue, const void *elem)
+{
+	void *slot = fvc_queue_reserve(queue);
+
+	if (slot == NULL)
+	{
+		return false;
+	}
+
+	memcpy(slot, elem, queue->elem_size);
+	fvc_queue_commit(queue);
+	return true;
+}
+
+bool fvc_queue_pop(struct fvc_queue *queue, void *elem)
+{
+	void *slot = fvc_queue_peek(queue);
+
+	if (slot == NULL)
+	{
+		return false;
+	}
+
+	memcpy(elem, slot, queue->elem_size);
+	fvc_queue_release(queue);
+	return true;
+}
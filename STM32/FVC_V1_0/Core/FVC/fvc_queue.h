@@ -0,0 +1,78 @@
+#ifndef FVC_QUEUE_H
+#define FVC_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring of fixed size elements
+ *  producer (usually ISR) only writes head, consumer (thread) only writes tail
+ *  indexes run freely and are masked, capacity has to be power of two
+ *  memory barriers order element access against index updates
+ */
+struct fvc_queue
+{
+	uint8_t *storage;
+	size_t elem_size;
+	uint32_t mask;				// capacity - 1
+	volatile uint32_t head;		// next slot written by producer
+	volatile uint32_t tail;		// next slot read by consumer
+};
+
+#define FVC_QUEUE_DEFINE(_name, _type, _capacity) \
+	_Static_assert((((_capacity) & ((_capacity) - 1)) == 0) && ((_capacity) > 0), "queue capacity has to be power of two"); \
+	static _type _name##_storage[_capacity]; \
+	static struct fvc_queue _name = {(uint8_t *) _name##_storage, sizeof(_type), (_capacity) - 1, 0, 0}
+
+/**
+ * @brief Gets free slot to be filled in place, producer only
+ * @param [in] queue - queue
+ * @return slot, NULL if queue is full
+ */
+void *fvc_queue_reserve(struct fvc_queue *queue);
+
+/**
+ * @brief Publishes slot returned by fvc_queue_reserve, producer only
+ * @param [in] queue - queue
+ */
+void fvc_queue_commit(struct fvc_queue *queue);
+
+/**
+ * @brief Gets oldest element without removing it, consumer only
+ * @param [in] queue - queue
+ * @return element, NULL if queue is empty
+ */
+void *fvc_queue_peek(struct fvc_queue *queue);
+
+/**
+ * @brief Gets element after oldest one without removing anything, consumer only
+ * @param [in] queue - queue
+ * @param [in] offset - position counted from oldest element
+ * @return element, NULL if queue holds fewer elements
+ */
+void *fvc_queue_peek_at(struct fvc_queue *queue, uint32_t offset);
+
+/**
+ * @brief Releases element returned by fvc_queue_peek, consumer only
+ * @param [in] queue - queue
+ */
+void fvc_queue_release(struct fvc_queue *queue);
+
+/**
+ * @brief Copies element into queue, producer only
+ * @param [in] queue - queue
+ * @param [in] elem - element of queue element size
+ * @return false if queue is full
+ */
+bool fvc_queue_push(struct fvc_queue *queue, const void *elem);
+
+/**
+ * @brief Copies oldest element out of queue, consumer only
+ * @param [in] queue - queue
+ * @param [out] elem - element of queue element size
+ * @return false if queue is empty
+ */
+bool fvc_queue_pop(struct fvc_queue *queue, void *elem);
+
+#endif
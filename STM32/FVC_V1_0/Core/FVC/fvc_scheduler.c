@@ -0,0 +1,91 @@
+#include "fvc_scheduler.h"
+#include "bsp.h"
+
+static struct fvc_sched_task *tasks[SCHED_MAX_TASKS];
+static size_t task_cnt = 0;
+
+static bool _is_ready(struct fvc_sched_task *task, uint32_t now)
+{
+	return task->pending || ((task->period_ms != 0) && ((int32_t) (now - task->next_run_tick) >= 0));
+}
+
+static struct fvc_sched_task *_get_ready_task(void)
+{
+	uint32_t now = HAL_GetTick();
+
+	for (size_t i = 0; i < task_cnt; i++)
+	{
+		if (_is_ready(tasks[i], now))
+		{
+			return tasks[i];
+		}
+	}
+	return NULL;
+}
+
+static void _execute(struct fvc_sched_task *task)
+{
+	// event posted while task runs makes it ready again, so it is never lost
+	task->pending = false;
+	task->next_run_tick = HAL_GetTick() + task->period_ms;
+
+	uint32_t start = bsp_get_cycles();
+	task->run();
+	uint32_t run_us = (bsp_get_cycles() - start) / (SystemCoreClock / 1000000);
+
+	task->runs++;
+	if (run_us > task->max_run_us)
+	{
+		task->max_run_us = run_us;
+	}
+	if ((task->budget_us != 0) && (run_us > task->budget_us))
+	{
+		task->overruns++;
+	}
+}
+
+bool fvc_sched_add(struct fvc_sched_task *task)
+{
+	size_t pos = task_cnt;
+
+	if (task_cnt >= SCHED_MAX_TASKS)
+	{
+		return false;
+	}
+
+	while ((pos > 0) && (tasks[pos - 1]->priority > task->priority))
+	{
+		tasks[pos] = tasks[pos - 1];
+		pos--;
+	}
+
+	task->pending = false;
+	task->next_run_tick = HAL_GetTick();
+	tasks[pos] = task;
+	task_cnt++;
+	return true;
+}
+
+void fvc_sched_post(struct fvc_sched_task *task)
+{
+	task->pending = true;
+}
+
+void fvc_sched_run(void)
+{
+	struct fvc_sched_task *task = _get_ready_task();
+
+	if (task != NULL)
+	{
+		_execute(task);
+		return;
+	}
+
+	// interrupt that arrives after the check is still pending, so WFI returns immediately
+	__disable_irq();
+	if (_get_ready_task() == NULL)
+	{
+		__WFI();
+	}
+	__enable_irq();
+}
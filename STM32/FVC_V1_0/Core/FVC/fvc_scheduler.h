@@ -0,0 +1,52 @@
+#ifndef FVC_SCHEDULER_H
+#define FVC_SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SCHED_MAX_TASKS			8
+
+/*
+ * Cooperative run-to-completion scheduler
+ *  task is ready when event was posted for it (usually from ISR) or its period elapsed
+ *  each pass runs ready task with the lowest priority value, tasks never preempt each other
+ *  core sleeps in WFI while no task is ready, any interrupt (SysTick at least every 1 ms) wakes it up
+ */
+typedef void (*sched_run_t)(void);
+
+struct fvc_sched_task
+{
+	const char *name;
+	sched_run_t run;
+	uint8_t priority;			// 0 is the most urgent
+	uint32_t period_ms;			// 0 - task runs on posted events only
+	uint32_t budget_us;			// longer runs are counted as overruns
+
+	// maintained by scheduler
+	volatile bool pending;
+	uint32_t next_run_tick;
+	uint32_t runs;
+	uint32_t overruns;
+	uint32_t max_run_us;
+};
+
+/**
+ * @brief Registers task, tasks are kept sorted by priority
+ * @param [in] task - task descriptor, has to stay valid
+ * @return false if there is no free slot
+ */
+bool fvc_sched_add(struct fvc_sched_task *task);
+
+/**
+ * @brief Marks task as ready, can be called from ISR
+ * @param [in] task - task to run
+ */
+void fvc_sched_post(struct fvc_sched_task *task);
+
+/**
+ * @brief Runs one ready task or sleeps until next interrupt when none is ready
+ */
+void fvc_sched_run(void);
+
+#endif
@@ -0,0 +1,102 @@
+#include "fvc_scrubber.h"
+#include "fvc_hash.h"
+#include "fvc_eeprom.h"
+#include "fvc_protocol.h"
+#include "bsp.h"
+
+#define SCRUB_CHUNK_LEN			256
+#define SCRUB_RECORD_WORDS		3	// result, boot count, uptime [s]
+
+void fvc_scrub_start(struct fvc_scrub *scrub, enum scrub_region region, scrub_read_t read, uint32_t addr, uint32_t len, uint32_t expected_hash)
+{
+	scrub->region = region;
+	scrub->read = read;
+	scrub->addr = addr;
+	scrub->offset = 0;
+	scrub->len = len;
+	scrub->expected_hash = expected_hash;
+	scrub->hash = 0xFFFFFFFF;
+	scrub->active = true;
+}
+
+enum scrub_result fvc_scrub_step(struct fvc_scrub *scrub, size_t chunks)
+{
+	uint8_t data[SCRUB_CHUNK_LEN];
+
+	if (!scrub->active)
+	{
+		return SCRUB_RESULT_NONE;
+	}
+
+	for (size_t i = 0; (i < chunks) && (scrub->offset < scrub->len); i++)
+	{
+		uint32_t len = scrub->len - scrub->offset;
+		if (len > SCRUB_CHUNK_LEN)
+		{
+			len = SCRUB_CHUNK_LEN;
+		}
+
+		if (!scrub->read(scrub->addr + scrub->offset, data, SCRUB_CHUNK_LEN))
+		{
+			scrub->active = false;
+			return SCRUB_RESULT_READ_ERROR;
+		}
+
+		scrub->hash = fvc_calc_crc(scrub->hash, data, len);
+		scrub->offset += len;
+	}
+
+	if (scrub->offset < scrub->len)
+	{
+		return SCRUB_RESULT_NONE;
+	}
+
+	scrub->active = false;
+	return (scrub->hash == scrub->expected_hash) ? SCRUB_RESULT_OK : SCRUB_RESULT_MISMATCH;
+}
+
+void fvc_scrub_record(enum scrub_region region, enum scrub_result result)
+{
+	enum eeprom_addr addr = EEPROM_SCRUB_RECORDS + region * SCRUB_RECORD_WORDS;
+	static bool boot_counted = false;
+	uint32_t boot_count = 0;
+
+	// boot is counted with its first record, boots without finished pass are not stored
+	fvc_eeprom_read(EEPROM_BOOT_COUNT, &boot_count);
+	if (!boot_counted)
+	{
+		boot_count++;
+		boot_counted = fvc_eeprom_write(EEPROM_BOOT_COUNT, boot_count);
+	}
+
+	fvc_eeprom_write(addr, result);
+	fvc_eeprom_write(addr + 1, boot_count);
+	fvc_eeprom_write(addr + 2, HAL_GetTick() / 1000);
+}
+
+void fvc_scrub_get_status(uint8_t *data)
+{
+	for (enum scrub_region region = SCRUB_REGION_BACKUP; region < SCRUB_REGION_TOP; region++)
+	{
+		enum eeprom_addr addr = EEPROM_SCRUB_RECORDS + region * SCRUB_RECORD_WORDS;
+		uint32_t record[SCRUB_RECORD_WORDS] = {SCRUB_RESULT_NONE, 0, 0};
+		uint8_t *out = &data[region * SCRUB_STATUS_REGION_LEN];
+
+		for (size_t i = 0; i < SCRUB_RECORD_WORDS; i++)
+		{
+			if (!fvc_eeprom_read(addr + i, &record[i]))
+			{
+				record[i] = 0;
+			}
+		}
+
+		out[0] = (uint8_t) record[0];
+		for (size_t i = 1; i < SCRUB_RECORD_WORDS; i++)
+		{
+			out[4 * i - 3] = (uint8_t) (record[i] >> 24);
+			out[4 * i - 2] = (uint8_t) (record[i] >> 16);
+			out[4 * i - 1] = (uint8_t) (record[i] >> 8);
+			out[4 * i] = (uint8_t) record[i];
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef FVC_SCRUBBER_H
+#define FVC_SCRUBBER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+enum scrub_region
+{
+	SCRUB_REGION_BACKUP = 0,
+	SCRUB_REGION_TARGET,
+
+	SCRUB_REGION_TOP
+};
+
+enum scrub_result
+{
+	SCRUB_RESULT_NONE = 0,		// pass not finished yet
+	SCRUB_RESULT_OK,
+	SCRUB_RESULT_MISMATCH,
+	SCRUB_RESULT_READ_ERROR,
+
+	SCRUB_RESULT_TOP
+};
+
+typedef bool (*scrub_read_t)(uint32_t addr, uint8_t *data, size_t data_len);
+
+struct fvc_scrub
+{
+	bool active;
+	enum scrub_region region;
+	scrub_read_t read;
+	uint32_t addr;
+	uint32_t offset;
+	uint32_t len;
+	uint32_t expected_hash;
+	uint32_t hash;
+};
+
+/**
+ * @brief Starts new pass over memory region
+ * @param [in] scrub - scrubber context
+ * @param [in] region - region recorded with result
+ * @param [in] read - reads 256 B chunk of region
+ * @param [in] addr - start address passed to read function
+ * @param [in] len - length of image
+ * @param [in] expected_hash - CRC of image
+ */
+void fvc_scrub_start(struct fvc_scrub *scrub, enum scrub_region region, scrub_read_t read, uint32_t addr, uint32_t len, uint32_t expected_hash);
+
+/**
+ * @brief Verifies next part of region
+ * @param [in] scrub - scrubber context
+ * @param [in] chunks - number of 256 B chunks to verify
+ * @return SCRUB_RESULT_NONE while pass is in progress, result of the pass otherwise
+ */
+enum scrub_result fvc_scrub_step(struct fvc_scrub *scrub, size_t chunks);
+
+/**
+ * @brief Stores result of finished pass with boot count and uptime in EEPROM
+ * @param [in] region - verified region
+ * @param [in] result - result of the pass
+ */
+void fvc_scrub_record(enum scrub_region region, enum scrub_result result);
+
+/**
+ * @brief Serializes last recorded results of all regions
+ * @param [out] data - output buffer, SCRUB_STATUS_LEN bytes
+ */
+void fvc_scrub_get_status(uint8_t *data);
+
+#endif
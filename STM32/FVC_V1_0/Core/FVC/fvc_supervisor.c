@@ -10,79 +10,159 @@
  */
 
 #include "fvc_supervisor.h"
+#include "fvc_hash.h"
+#include "fvc_log.h"
 #include "bsp.h"
-#include "stdlib.h"
+#include "string.h"
+
+/*
+    supervisee drives the link: every command or value is received into rx_buf and answered with one byte,
+    transfers run in SPI interrupt and supervisor_loop only reacts to finished ones, so it never waits for the bus
+*/
 
 /*
     private helper functions
 */
-static uint8_t receive_byte(supervisor_t* sup)
+static uint16_t expected_rx_len(supervisor_t* sup)
 {
-    uint8_t buf;
-    
-    if(sup->receive(&buf, 1, SPI_TIMEOUT_MS))
+    switch(sup->state)
     {
-        return buf;
+    case supervisor_state_setting_variables:
+    case supervisor_state_setting_period:
+    case supervisor_state_setting_window:
+    case supervisor_state_check_variables:
+        return 4;
+    case supervisor_state_check_variables_batch:
+        return SUPERVISION_BATCH_FRAME_LEN(sup->var_nb);
+    default:
+        return 1;
     }
-    
-    return 0;
 }
 
-static supervision_command_t receive_command(supervisor_t* sup)
+static void start_receive(supervisor_t* sup)
 {
-    uint8_t command;
+    sup->transfer_done = false;
+    sup->transfer = supervisor_transfer_receiving;
+    sup->transfer_start_tick = HAL_GetTick();
 
-    command = receive_byte(sup);
+    if(!sup->receive(sup->rx_buf, expected_rx_len(sup)))
+    {
+        sup->transfer = supervisor_transfer_idle;
+    }
+}
 
-    if(command != 0)
+static void cancel_transfer(supervisor_t* sup)
+{
+    if(sup->transfer != supervisor_transfer_idle)
     {
-        return (supervision_command_t) command;
+        sup->abort();
+        sup->transfer = supervisor_transfer_idle;
+        sup->transfer_done = false;
     }
 
-    return supervision_command_top; 
+    // broken batch frame, supervisee starts over with next refresh command
+    if(sup->state == supervisor_state_check_variables_batch)
+    {
+        sup->state = supervisor_state_awaiting_refresh;
+    }
+}
+
+static supervision_command_t decode_command(supervisor_t* sup)
+{
+    if(sup->rx_buf[0] != 0)
+    {
+        return (supervision_command_t) sup->rx_buf[0];
+    }
+
+    return supervision_command_top;
+}
+
+static int32_t decode_4_bytes(const uint8_t* buf)
+{
+    return ((int32_t)buf[0]|(((int32_t)buf[1])<<8)|(((int32_t)buf[2])<<16)|(((int32_t)buf[3])<<24));
 }
 
 static void send_response(supervisor_t* sup, bool ack)
 {
-    uint8_t resp = 1;
+    sup->tx_buf = 1;
 
     if(!ack)
-	{
-    	resp = 0;
-	}
+    {
+        sup->tx_buf = 0;
+    }
 
     for(uint8_t i = 0; i < SPI_RETRY_CNT; i++)
     {
-        if(sup->transmit(&resp, 1, SPI_TIMEOUT_MS))
+        sup->transfer_done = false;
+        sup->transfer = supervisor_transfer_transmitting;
+        sup->transfer_start_tick = HAL_GetTick();
+
+        if(sup->transmit(&sup->tx_buf, 1))
         {
             return;
         }
     }
 
-    return;
+    sup->transfer = supervisor_transfer_idle;
 }
 
-static int32_t receive_4_bytes(supervisor_t* sup)
+static void receive_variable_range(supervisor_t* sup)
 {
-    uint8_t buf[4] = {0};
-    sup->receive(buf, 4, SPI_TIMEOUT_MS);
-    return ((int32_t)buf[0]|(((int32_t)buf[1])<<8)|(((int32_t)buf[2])<<16)|(((int32_t)buf[3])<<24));
+    if(sup->var_idx >= sup->var_nb)
+    {
+        sup->state = supervisor_state_awaiting_configuration;
+        return;
+    }
+
+    if(!sup->range_max_pending)
+    {
+        sup->pool.min_val[sup->var_idx] = decode_4_bytes(sup->rx_buf);
+        sup->range_max_pending = true;
+        send_response(sup, true);
+        return;
+    }
+
+    sup->pool.max_val[sup->var_idx] = decode_4_bytes(sup->rx_buf);
+    sup->range_max_pending = false;
+    send_response(sup, true);
+
+    sup->var_idx++;
+    sup->timer_start_refresh(INITIAL_RESET_TIMER_US);
+
+    if(sup->var_idx >= sup->var_nb)
+    {
+        sup->state = supervisor_state_awaiting_configuration;
+    }
 }
 
-static bool receive_variable_range(supervisor_t* sup, uint8_t var_nb)
+// both compares are evaluated, compiler emits conditional execution instead of branches
+static inline uint32_t is_in_range(const supervision_pool_t* pool, uint8_t idx, int32_t value)
 {
-    if(var_nb >= sup->var_nb)
+    return (uint32_t)(value >= pool->min_val[idx]) & (uint32_t)(value <= pool->max_val[idx]);
+}
+
+static void clear_checked(supervisor_t* sup)
+{
+    memset(sup->pool.checked, 0, sizeof(sup->pool.checked));
+}
+
+static bool all_variables_checked(supervisor_t* sup)
+{
+    uint32_t missing = 0;
+    uint8_t full_words = sup->var_nb / 32;
+    uint8_t tail_bits = sup->var_nb % 32;
+
+    for(uint8_t i = 0; i < full_words; i++)
     {
-        return false;
+        missing |= ~sup->pool.checked[i];
     }
 
-    sup->supervision_variables[var_nb].min_val = (uint32_t)receive_4_bytes(sup);
-    send_response(sup, true);
-    sup->supervision_variables[var_nb].max_val = (uint32_t)receive_4_bytes(sup);
-    send_response(sup, true);
-    sup->supervision_variables[var_nb].checked = false;
+    if(tail_bits != 0)
+    {
+        missing |= ~sup->pool.checked[full_words] & ((1UL << tail_bits) - 1);
+    }
 
-    return true;
+    return missing == 0;
 }
 
 static bool receive_check_variable(supervisor_t* sup, uint8_t var_nb)
@@ -91,48 +171,146 @@ static bool receive_check_variable(supervisor_t* sup, uint8_t var_nb)
     {
         return false;
     }
-    
-    int32_t recv_var;
-    recv_var = receive_4_bytes(sup);
 
-    if((recv_var <= sup->supervision_variables[var_nb].max_val) && (recv_var >= sup->supervision_variables[var_nb].min_val))
+    if(is_in_range(&sup->pool, var_nb, decode_4_bytes(sup->rx_buf)))
     {
-        sup->supervision_variables[var_nb].checked = true;
+        sup->pool.checked[var_nb / 32] |= 1UL << (var_nb % 32);
         return true;
     }
 
+    sup->stats.out_of_range[var_nb]++;
     return false;
 }
-/*
-    private helper functions end
-*/
 
-void supervisor_init(supervisor_t* sup, transmit_t transmit, receive_t receive, timer_start_refresh_t timer_start_refresh, reset_t reset)
-{   
-    bsp_supervisor_init();
-    sup->state = supervisor_state_uninitialized;
-    sup->transmit = transmit; 
-    sup->receive = receive;
-    sup->timer_start_refresh = timer_start_refresh;
-    sup->reset = reset;
+static bool receive_check_variables_batch(supervisor_t* sup)
+{
+    uint16_t values_len = sup->var_nb * 4;
+    uint32_t in_range = 1;
+
+    if((uint32_t)decode_4_bytes(&sup->rx_buf[values_len]) != fvc_calc_crc(0xFFFFFFFF, sup->rx_buf, values_len))
+    {
+        sup->stats.crc_errors++;
+        LOG_WARN(LOG_MODULE_SUPERVISOR, "Supervision batch CRC error\n\r");
+        return false;
+    }
+
+    for(uint8_t i = 0; i < sup->var_nb; i++)
+    {
+        uint32_t var_in_range = is_in_range(&sup->pool, i, decode_4_bytes(&sup->rx_buf[i * 4]));
+
+        sup->stats.out_of_range[i] += var_in_range ^ 1;
+        in_range &= var_in_range;
+    }
 
-    sup->timer_start_refresh(INITIAL_RESET_TIMER_MS);
+    return in_range != 0;
 }
 
-void supervisor_loop(supervisor_t* sup)
+static uint32_t ms_to_us(uint32_t ms)
+{
+    if(ms > (UINT32_MAX / 1000))
+    {
+        return UINT32_MAX;
+    }
+
+    return ms * 1000;
+}
+
+static void start_supervision_period(supervisor_t* sup)
+{
+    sup->refresh_lag_us = 0;
+    sup->timer_start_refresh(sup->supervision_period_us);
+}
+
+// next period is counted from refresh command, not from the end of its processing
+static void restart_supervision_period(supervisor_t* sup)
+{
+    uint32_t lag = sup->timer_elapsed() - sup->refresh_timestamp_us;
+
+    if(lag >= sup->supervision_period_us)
+    {
+        lag = sup->supervision_period_us - 1;
+    }
+
+    sup->refresh_lag_us = lag;
+    sup->timer_start_refresh(sup->supervision_period_us - lag);
+}
+
+static void record_refresh_interval(supervision_stats_t* stats, uint32_t interval)
+{
+    uint8_t bucket = (interval != 0) ? (31 - __CLZ(interval)) : 0;
+
+    if((stats->refreshes == 0) || (interval < stats->interval_min_us))
+    {
+        stats->interval_min_us = interval;
+    }
+
+    if(interval > stats->interval_max_us)
+    {
+        stats->interval_max_us = interval;
+    }
+
+    stats->refreshes++;
+    stats->interval_sum_us += interval;
+    stats->interval_histogram[bucket]++;
+}
+
+static bool is_refresh_in_window(supervisor_t* sup)
+{
+    sup->refresh_timestamp_us = sup->rx_timestamp_us;
+    sup->last_refresh_interval_us = sup->refresh_lag_us + sup->refresh_timestamp_us;
+    record_refresh_interval(&sup->stats, sup->last_refresh_interval_us);
+
+    if(sup->last_refresh_interval_us < sup->supervision_window_us)
+    {
+        sup->stats.early_refreshes++;
+        LOG_WARN(LOG_MODULE_SUPERVISOR, "Early refresh after %d us\n\r", sup->last_refresh_interval_us);
+        return false;
+    }
+
+    return true;
+}
+
+static void receive_window(supervisor_t* sup)
+{
+    uint32_t value = (uint32_t)decode_4_bytes(sup->rx_buf);
+
+    if(!sup->window_period_pending)
+    {
+        sup->supervision_window_us = value;
+        sup->window_period_pending = true;
+        send_response(sup, true);
+        return;
+    }
+
+    sup->window_period_pending = false;
+
+    if((value == 0) || (sup->supervision_window_us >= value))
+    {
+        sup->supervision_window_us = 0;
+        send_response(sup, false);
+        sup->state = supervisor_state_awaiting_configuration;
+        return;
+    }
+
+    send_response(sup, true);
+    sup->supervision_period_us = value;
+    start_supervision_period(sup);
+    sup->state = supervisor_state_awaiting_refresh;
+}
+
+static void process_received(supervisor_t* sup)
 {
-	static uint8_t configured_var_nb;
     supervision_command_t command;
     uint32_t period;
 
-	switch(sup->state)
+    switch(sup->state)
     {
     case supervisor_state_uninitialized:
-        command = receive_command(sup);
+        command = decode_command(sup);
         if(command == supervision_command_init) //wait for supervisee initial transmission
         {
             send_response(sup, true);
-            sup->timer_start_refresh(INITIAL_RESET_TIMER_MS);
+            sup->timer_start_refresh(INITIAL_RESET_TIMER_US);
             sup->state = supervisor_state_awaiting_configuration;   
         }
         else if(command != supervision_command_top)
@@ -141,99 +319,108 @@ void supervisor_loop(supervisor_t* sup)
         }
     break;
     case supervisor_state_awaiting_configuration:
-        command = receive_command(sup);
+        command = decode_command(sup);
         if(command == supervision_command_set_variable_nb)
         {
             send_response(sup, true);
-            sup->timer_start_refresh(INITIAL_RESET_TIMER_MS);
-            if(sup->supervision_variables != NULL)
-            {
-                free(sup->supervision_variables);
-            }
+            sup->timer_start_refresh(INITIAL_RESET_TIMER_US);
+            clear_checked(sup);
             sup->var_nb = 0;
-            configured_var_nb = 0;
+            sup->var_idx = 0;
+            sup->range_max_pending = false;
             sup->state = supervisor_state_setting_variables_nb;
         }
         else if(command == supervision_command_set_period)
         {
             send_response(sup, true);
-            sup->timer_start_refresh(INITIAL_RESET_TIMER_MS);
+            sup->timer_start_refresh(INITIAL_RESET_TIMER_US);
             sup->state = supervisor_state_setting_period;
         }
+        else if(command == supervision_command_set_window)
+        {
+            send_response(sup, true);
+            sup->timer_start_refresh(INITIAL_RESET_TIMER_US);
+            sup->window_period_pending = false;
+            sup->state = supervisor_state_setting_window;
+        }
         else if(command != supervision_command_top)
         {
             send_response(sup, false);
         }
     break;
     case supervisor_state_setting_variables_nb:
-        sup->var_nb = receive_byte(sup);
+        sup->var_nb = sup->rx_buf[0];
 
         if(sup->var_nb != 0)
         {
-			sup->supervision_variables = calloc(sup->var_nb, sizeof(supervision_variable_t));
-
-			if(sup->supervision_variables == NULL)
-			{
-				send_response(sup, false);
-				sup->state = supervisor_state_awaiting_configuration;
-				break;
-			}
-
-			send_response(sup, true);
-            sup->timer_start_refresh(INITIAL_RESET_TIMER_MS);
+            send_response(sup, true);
+            sup->timer_start_refresh(INITIAL_RESET_TIMER_US);
             sup->state = supervisor_state_setting_variables;
         }
         else
         {
-        	send_response(sup, false);
-        	sup->state = supervisor_state_awaiting_configuration;
+            send_response(sup, false);
+            sup->state = supervisor_state_awaiting_configuration;
         }
     break;
     case supervisor_state_setting_variables:
-        if(receive_variable_range(sup, configured_var_nb++))
+        receive_variable_range(sup);
+    break;
+    case supervisor_state_setting_period:
+        period = (uint32_t)decode_4_bytes(sup->rx_buf);
+        if(period != 0)
         {
-            sup->timer_start_refresh(INITIAL_RESET_TIMER_MS);
-
-            if(configured_var_nb >= sup->var_nb)
-            {
-                sup->state = supervisor_state_awaiting_configuration;
-            }
+            send_response(sup, true);
+            sup->supervision_period_us = ms_to_us(period);
+            start_supervision_period(sup);
+            sup->state = supervisor_state_awaiting_refresh;
+        }
+        else
+        {
+            send_response(sup, false);
         }
     break;
-    case supervisor_state_setting_period:
-    	period = (uint32_t)receive_4_bytes(sup);
-    	if(period != 0)
-    	{
-        send_response(sup, true);
-        sup->supervision_period = period;
-        sup->timer_start_refresh(sup->supervision_period);
-        sup->state = supervisor_state_awaiting_refresh;
-    	}
-    	else
-    	{
-    		send_response(sup, false);
-    	}
+    case supervisor_state_setting_window:
+        receive_window(sup);
     break;
     case supervisor_state_awaiting_refresh:
-        command = receive_command(sup);
-        if(command == supervision_command_refresh)
+        command = decode_command(sup);
+        if(((command == supervision_command_refresh) || (command == supervision_command_refresh_batch)) && !is_refresh_in_window(sup))
+        {
+            send_response(sup, false);
+            sup->state = supervisor_state_resetting; // refreshing too often, supervisee is running away
+        }
+        else if(command == supervision_command_refresh)
         {
             if(sup->var_nb != 0)
             {
                 send_response(sup, true);
                 sup->state = supervisor_state_check_variables;
-                configured_var_nb = 0;
+                sup->var_idx = 0;
             }
             else
             {
-            	send_response(sup, true);
-            	sup->timer_start_refresh(sup->supervision_period);
+                send_response(sup, true);
+                restart_supervision_period(sup);
             }   
         }
+        else if(command == supervision_command_refresh_batch)
+        {
+            if(sup->var_nb == 0)
+            {
+                send_response(sup, true);
+                restart_supervision_period(sup);
+            }
+            else
+            {
+                send_response(sup, true);
+                sup->state = supervisor_state_check_variables_batch;
+            }
+        }
         else if(command == supervision_command_reconfigure)
         {
-        	send_response(sup, true);
-        	sup->timer_start_refresh(INITIAL_RESET_TIMER_MS);
+            send_response(sup, true);
+            sup->timer_start_refresh(INITIAL_RESET_TIMER_US);
             sup->state = supervisor_state_awaiting_configuration;
         }
         else if(command != supervision_command_top)
@@ -242,7 +429,7 @@ void supervisor_loop(supervisor_t* sup)
         }
     break;
     case supervisor_state_check_variables:
-        if(receive_check_variable(sup, configured_var_nb++))
+        if(receive_check_variable(sup, sup->var_idx++))
         {
             send_response(sup, true);
         }
@@ -252,39 +439,124 @@ void supervisor_loop(supervisor_t* sup)
             sup->state = supervisor_state_awaiting_refresh;
         }
 
-        bool all_checked = true;
-
-        for(uint8_t i = 0; i < sup->var_nb; i++)
+        if(all_variables_checked(sup))
         {
-            if(!sup->supervision_variables[i].checked)
-            {
-                all_checked = false;
-            } 
+            restart_supervision_period(sup);
+            clear_checked(sup);
+            sup->state = supervisor_state_awaiting_refresh;
         }
 
-        if(all_checked)
+    break;
+    case supervisor_state_check_variables_batch:
+        // whole set is validated at once, per-variable checked flags are not used
+        if(receive_check_variables_batch(sup))
         {
-            sup->timer_start_refresh(sup->supervision_period); 
-            for(uint8_t i = 0; i < sup->var_nb; i++)
-            {
-                sup->supervision_variables[i].checked = false;
-            }
-            sup->state = supervisor_state_awaiting_refresh;
+            send_response(sup, true);
+            restart_supervision_period(sup);
         }
-
+        else
+        {
+            send_response(sup, false);
+        }
+        sup->state = supervisor_state_awaiting_refresh;
+    break;
+    default:
     break;
-    case supervisor_state_resetting:
+    }
+}
+/*
+    private helper functions end
+*/
+
+void supervisor_init(supervisor_t* sup, transmit_t transmit, receive_t receive, abort_t abort, timer_start_refresh_t timer_start_refresh, timer_elapsed_t timer_elapsed, reset_t reset)
+{   
+    bsp_supervisor_init(); // any pending transfer is dropped with SPI reinitialization
+    sup->state = supervisor_state_uninitialized;
+    sup->transmit = transmit; 
+    sup->receive = receive;
+    sup->abort = abort;
+    sup->timer_start_refresh = timer_start_refresh;
+    sup->timer_elapsed = timer_elapsed;
+    sup->reset = reset;
+    sup->supervision_window_us = 0;
+    sup->transfer = supervisor_transfer_idle;
+    sup->transfer_done = false;
+
+    sup->timer_start_refresh(INITIAL_RESET_TIMER_US);
+}
+
+void supervisor_loop(supervisor_t* sup)
+{
+    if(sup->state == supervisor_state_resetting)
+    {
+        cancel_transfer(sup); // partially received value would shift all following frames
+        sup->stats.resets++;
+        LOG_WARN(LOG_MODULE_SUPERVISOR, "Supervision failed, resetting supervisee\n\r");
         sup->reset(); //reseting supervisee
         sup->state = supervisor_state_uninitialized;
-        sup->timer_start_refresh(INITIAL_RESET_TIMER_MS);
-    break;
-    default:
+        sup->timer_start_refresh(INITIAL_RESET_TIMER_US);
+        return;
+    }
+
+    if(sup->state > supervisor_state_resetting)
+    {
+        cancel_transfer(sup);
         sup->state = supervisor_state_uninitialized;
-    break;
+        return;
     }
+
+    if(sup->transfer != supervisor_transfer_idle)
+    {
+        if(!sup->transfer_done)
+        {
+            if((HAL_GetTick() - sup->transfer_start_tick) > SPI_TIMEOUT_MS)
+            {
+                cancel_transfer(sup);
+            }
+            return;
+        }
+
+        supervisor_transfer_t finished = sup->transfer;
+        sup->transfer = supervisor_transfer_idle;
+        sup->transfer_done = false;
+
+        if((finished == supervisor_transfer_receiving) && sup->transfer_ok)
+        {
+            process_received(sup);
+
+            if(sup->transfer != supervisor_transfer_idle)
+            {
+                return; // response is being sent
+            }
+        }
+        else if(finished == supervisor_transfer_receiving)
+        {
+            cancel_transfer(sup);
+        }
+    }
+
+    start_receive(sup);
 }
 
 void supervisor_timer_period_elapsed_callback(supervisor_t* sup)
 {  
     sup->state = supervisor_state_resetting;
 }
+
+void supervisor_transfer_complete_callback(supervisor_t* sup, bool ok)
+{
+    if(sup->transfer != supervisor_transfer_idle)
+    {
+        if(sup->transfer == supervisor_transfer_receiving)
+        {
+            sup->rx_timestamp_us = sup->timer_elapsed();
+        }
+        sup->transfer_ok = ok;
+        sup->transfer_done = true;
+    }
+}
+
+void supervisor_clear_stats(supervisor_t* sup)
+{
+    memset(&sup->stats, 0, sizeof(sup->stats));
+}
@@ -17,11 +17,29 @@
 
 #define SPI_TIMEOUT_MS 5000
 #define SPI_RETRY_CNT 5
-#define INITIAL_RESET_TIMER_MS 10000
+#define INITIAL_RESET_TIMER_US 10000000UL
 
-typedef bool (*transmit_t)(uint8_t *data, uint16_t len, uint32_t timeout);
-typedef bool (*receive_t)(uint8_t *data, uint16_t len, uint32_t timeout);
-typedef void (*timer_start_refresh_t)(uint32_t period);
+// var_nb is sent as one byte, pool holds any configuration
+#define SUPERVISION_MAX_VAR_NB 255
+#define SUPERVISION_CHECKED_WORDS ((SUPERVISION_MAX_VAR_NB + 31) / 32)
+
+/*
+    batched refresh frame: var_nb values (4 B, little endian) followed by CRC32 of values (4 B, little endian)
+*/
+#define SUPERVISION_BATCH_CRC_LEN 4
+#define SUPERVISION_BATCH_FRAME_LEN(_var_nb) ((_var_nb) * 4 + SUPERVISION_BATCH_CRC_LEN)
+
+// bucket n counts refresh intervals from 2^n us to 2^(n+1) - 1 us, bucket 0 also counts 0 us
+#define SUPERVISION_HISTOGRAM_BUCKETS 32
+
+/*
+    transfers are only started here, completion is reported through supervisor_transfer_complete_callback
+*/
+typedef bool (*transmit_t)(uint8_t *data, uint16_t len);
+typedef bool (*receive_t)(uint8_t *data, uint16_t len);
+typedef void (*abort_t)(void);
+typedef void (*timer_start_refresh_t)(uint32_t period_us);
+typedef uint32_t (*timer_elapsed_t)(void); // microseconds since timer start, safe to call from interrupt
 typedef void (*reset_t)(void);
 
 typedef enum {
@@ -30,11 +48,19 @@ typedef enum {
     supervisor_state_setting_variables_nb,
     supervisor_state_setting_variables,
     supervisor_state_setting_period,
+    supervisor_state_setting_window,
     supervisor_state_awaiting_refresh,
     supervisor_state_check_variables,
+    supervisor_state_check_variables_batch,
     supervisor_state_resetting
 } supervisor_state_t;
 
+typedef enum {
+    supervisor_transfer_idle,
+    supervisor_transfer_receiving,
+    supervisor_transfer_transmitting
+} supervisor_transfer_t;
+
 typedef enum {
     supervision_command_init = 1,
     supervision_command_set_variable_nb,
@@ -42,28 +68,61 @@ typedef enum {
     supervision_command_set_period,
     supervision_command_refresh,
     supervision_command_reconfigure,
+    supervision_command_refresh_batch,
+    supervision_command_set_window, // T_min (us), period (us), each followed by response
     supervision_command_top
 } supervision_command_t;
 
 typedef struct {
-    bool checked;
-    int32_t min_val;
-    int32_t max_val;
-} supervision_variable_t;
+    int32_t min_val[SUPERVISION_MAX_VAR_NB];
+    int32_t max_val[SUPERVISION_MAX_VAR_NB];
+    uint32_t checked[SUPERVISION_CHECKED_WORDS]; // bit per variable
+} supervision_pool_t;
+
+typedef struct {
+    uint32_t refreshes;
+    uint32_t early_refreshes;
+    uint32_t crc_errors;
+    uint32_t resets;
+    uint32_t interval_min_us;
+    uint32_t interval_max_us;
+    uint64_t interval_sum_us;
+    uint32_t interval_histogram[SUPERVISION_HISTOGRAM_BUCKETS];
+    uint32_t out_of_range[SUPERVISION_MAX_VAR_NB];
+} supervision_stats_t;
 
 typedef struct {
     transmit_t transmit;
     receive_t receive;
+    abort_t abort;
     timer_start_refresh_t timer_start_refresh;
+    timer_elapsed_t timer_elapsed;
     reset_t reset;
     supervisor_state_t state;
-    uint32_t supervision_period;
+    uint32_t supervision_period_us;
+    uint32_t supervision_window_us; // refresh sooner after previous one is a fault, 0 disables window
+    bool window_period_pending;
+    uint32_t refresh_timestamp_us; // timer time of last refresh command
+    uint32_t refresh_lag_us; // refresh command to timer restart, added to next interval
+    uint32_t last_refresh_interval_us;
     uint8_t var_nb;
-    supervision_variable_t* supervision_variables;
+    uint8_t var_idx;
+    bool range_max_pending;
+    supervision_pool_t pool;
+    supervision_stats_t stats;
+    supervisor_transfer_t transfer;
+    volatile bool transfer_done;
+    volatile bool transfer_ok;
+    uint32_t transfer_start_tick;
+    volatile uint32_t rx_timestamp_us; // captured in interrupt when receive completes
+    uint8_t rx_buf[SUPERVISION_BATCH_FRAME_LEN(SUPERVISION_MAX_VAR_NB)];
+    uint8_t tx_buf;
 } supervisor_t;
 
-void supervisor_init(supervisor_t* sup, transmit_t transmit, receive_t receive, timer_start_refresh_t timer_start_refresh, reset_t reset);
+void supervisor_init(supervisor_t* sup, transmit_t transmit, receive_t receive, abort_t abort, timer_start_refresh_t timer_start_refresh, timer_elapsed_t timer_elapsed, reset_t reset);
 void supervisor_loop(supervisor_t* sup);
 void supervisor_timer_period_elapsed_callback(supervisor_t* sup);
+void supervisor_transfer_complete_callback(supervisor_t* sup, bool ok);
+void supervisor_clear_stats(supervisor_t* sup);
 
 #endif